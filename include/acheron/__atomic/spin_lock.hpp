@@ -0,0 +1,69 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <acheron/__atomic/atomic.hpp>
+#include <acheron/__libdef.hpp>
+
+namespace ach
+{
+    /**
+     * @brief Test-and-test-and-set spin lock built on top of ach::atomic
+     *
+     * @note Meant for very short critical sections, e.g. moving a batch of free blocks
+     *  between an allocator's thread cache and its central heap. It never yields to the
+     *  scheduler, so do not hold it across blocking calls.
+     * @note Satisfies the standard Lockable requirements; works with std::lock_guard
+     */
+    class spin_lock
+    {
+    public:
+        constexpr spin_lock() noexcept = default;
+
+        ACHERON_NOCOPY(spin_lock)
+        ACHERON_NOMOVE(spin_lock)
+
+        /**
+         * @brief Acquire the lock, spinning until it becomes available
+         */
+        void lock() noexcept
+        {
+            while (flag.exchange(true, memory_order::acquire))
+            {
+                /* spin on a plain load so waiters do not keep stealing the cache line */
+                while (flag.load(memory_order::relaxed))
+                    relax();
+            }
+        }
+
+        /**
+         * @brief Try to acquire the lock without spinning
+         * @return bool True if the lock was acquired
+         */
+        bool try_lock() noexcept
+        {
+            return !flag.load(memory_order::relaxed) &&
+                   !flag.exchange(true, memory_order::acquire);
+        }
+
+        /**
+         * @brief Release the lock
+         */
+        void unlock() noexcept
+        {
+            flag.store(false, memory_order::release);
+        }
+
+    private:
+        atomic<bool> flag;
+
+        static void relax() noexcept
+        {
+        #if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+        #elif defined(__aarch64__) || defined(__arm__)
+            __asm__ __volatile__("yield");
+        #endif
+        }
+    };
+}
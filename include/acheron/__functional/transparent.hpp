@@ -0,0 +1,21 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <type_traits>
+#include <acheron/__libdef.hpp>
+
+namespace ach
+{
+	namespace __detail
+	{
+		/* comparators and hashers declaring is_transparent accept any type comparable with the
+		 * key, so containers can be searched without building a key first */
+		template<typename T>
+		concept transparent = requires { typename T::is_transparent; };
+
+		/* a key argument that is not an iterator, for erase overloads taking either */
+		template<typename K, typename Iterator, typename ConstIterator>
+		concept key_argument = !std::is_convertible_v<K, Iterator> && !std::is_convertible_v<K, ConstIterator>;
+	}
+}
@@ -2,21 +2,74 @@
 
 #pragma once
 
+#include <concepts>
+#include <cstring>
 #include <limits>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <acheron/__libdef.hpp>
-#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
-/* we compile for Unix e.g. Linux, macOS and so on */
-#include <sys/mman.h>
-#elif defined(_WIN32) || defined(_WIN64)
-#include <windows.h>
-#error "Windows is not supported yet, but will be soon; hopefully"
-#else /* not supported at the moment, but will be soon; hopefully */
-#error "your OS not supported at the moment, but will be soon; hopefully"
-#endif
+#include <acheron/__memory/heap.hpp>
 
 namespace ach
 {
+	/**
+	 * @brief Whether objects of T may be moved to another address by copying their bytes
+	 *
+	 * @note Defaults to trivially copyable types; specialize it for types that hold no
+	 *  pointers into themselves to let containers grow them with allocator::reallocate
+	 */
+	template<typename T>
+	struct is_trivially_relocatable : std::bool_constant<std::is_trivially_copyable_v<T> > {};
+
+	template<typename T>
+	constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+	/**
+	 * @brief Allocators that can resize a block, e.g. ach::allocator
+	 */
+	template<typename Alloc>
+	concept reallocating_allocator = requires(Alloc &a, typename std::allocator_traits<Alloc>::pointer p,
+	                                          typename std::allocator_traits<Alloc>::size_type n)
+	{
+		{ a.reallocate(p, n, n) } -> std::same_as<typename std::allocator_traits<Alloc>::pointer>;
+		{ a.try_expand(p, n, n) } -> std::same_as<bool>;
+	};
+
+	/**
+	 * @brief Allocators that hand out single-object blocks in batches, e.g. ach::allocator
+	 */
+	template<typename Alloc>
+	concept batch_allocator = requires(Alloc &a, typename std::allocator_traits<Alloc>::pointer *ptrs,
+	                                   typename std::allocator_traits<Alloc>::size_type n)
+	{
+		a.allocate_batch(n, ptrs);
+		a.deallocate_batch(ptrs, n);
+	};
+
+	/**
+	 * @brief Allocators that tell how many bytes a block really takes, e.g. ach::allocator
+	 */
+	template<typename Alloc>
+	concept sizing_allocator = requires(const Alloc &a, typename std::allocator_traits<Alloc>::size_type n)
+	{
+		{ a.allocation_size(n) } -> std::same_as<size_t>;
+	};
+
+	/**
+	 * @brief Bytes `a` takes for a block of n objects, for containers reporting memory_usage()
+	 *
+	 * @note What the allocator reports if it is a sizing_allocator, the requested size otherwise
+	 */
+	template<typename Alloc>
+	size_t allocation_size(const Alloc &a, const size_t n) noexcept
+	{
+		if constexpr (sizing_allocator<Alloc>)
+			return a.allocation_size(n);
+		else
+			return n * sizeof(typename std::allocator_traits<Alloc>::value_type);
+	}
+
 	/**
 	 * @brief Memory allocator with pool-based allocation strategy
 	 *
@@ -24,6 +77,14 @@ namespace ach
 	 *  optimized memory allocation through size-based pools for small allocations and
 	 *  direct mmap for larger ones.
 	 *
+	 * @note The allocator itself is stateless; every specialization forwards to the single
+	 *  byte-level ach::heap, so blocks freed through allocator<A> are reused by allocator<B>.
+	 *  Allocation is thread-safe; see ach::heap for the caching scheme.
+	 *
+	 * @note Memory is aligned to alignof(T), however large; types up to 16-byte alignment cost
+	 *  nothing extra, over-aligned ones go through heap::allocate_aligned. allocate(n, align)
+	 *  asks for more, e.g. page-aligned buffers for O_DIRECT.
+	 *
 	 * @note This is not STL-compatible by any means. The containers may crash if this is used
 	 *  with the standard library
 	 * @tparam T Type of objects to allocate
@@ -31,6 +92,8 @@ namespace ach
 	template<typename T>
 	class allocator
 	{
+		ACHERON_STATIC_ASSERT(alignof(T) <= heap::MAX_ALIGNMENT, "alignment of T is not supported by ach::heap");
+
 	public:
 		using value_type = T;
 		using pointer = T *;
@@ -60,14 +123,11 @@ namespace ach
 		/**
 		 * @brief Default constructor
 		 *
-		 * Initializes a new allocator and prepares all size classes for allocation.
+		 * The allocator carries no state of its own; all size classes live in ach::heap.
 		 * This constructor is marked constexpr and noexcept to allow for compile-time
 		 * initialization and exception safety guarantees.
 		 */
-		constexpr allocator() noexcept
-		{
-			init_size_classes();
-		}
+		constexpr allocator() noexcept = default;
 
 		/**
 		 * @brief Copy constructor
@@ -92,26 +152,6 @@ namespace ach
 		template<typename U>
 		constexpr allocator(const allocator<U> &) noexcept {}
 
-		/**
-		 * @brief Destructor
-		 *
-		 * Cleans up all allocated memory pools. Iterates through each size class
-		 * and releases all associated memory pools back to the operating system.
-		 */
-		~allocator()
-		{
-			/* traverse and clean the pool :D */
-			for (auto pool: pools)
-			{
-				while (pool)
-				{
-					Pool *next = pool->next;
-					delete pool;
-					pool = next;
-				}
-			}
-		}
-
 		/**
 		 * @brief Allocate memory for n objects of type T
 		 *
@@ -128,16 +168,37 @@ namespace ach
 			if (n == 0)
 				return nullptr;
 
-			const size_type bytes_needed = n * sizeof(T);
-			void* result = nullptr;
+			if (n > max_size())
+				throw std::bad_array_new_length();
 
-			auto& state = get_global_state();
+			void *result = OVER_ALIGNED ? heap::allocate_aligned(n * sizeof(T), alignof(T)) : heap::allocate(n * sizeof(T));
+			if (!result)
+				throw std::bad_alloc();
 
-			if (bytes_needed >= LARGE_THRESHOLD)
-				result = allocate_large(bytes_needed);
-			else
-				result = allocate_from_size_class(get_size_class(bytes_needed));
+			return static_cast<pointer>(result);
+		}
+
+		/**
+		 * @brief Allocate memory for n objects of type T aligned to `align`
+		 *
+		 * @param n Number of objects to allocate memory for
+		 * @param align Required alignment; a power of two up to heap::MAX_ALIGNMENT. Values
+		 *  below alignof(T) are raised to it.
+		 * @return pointer The pointer to the allocated memory, or nullptr if n is zero
+		 * @throw std::bad_alloc if the memory could not be obtained or the alignment is not supported
+		 * @note Must be deallocated with deallocate(p, n, align)
+		 */
+		[[nodiscard]] pointer allocate(size_type n, size_t align)
+		{
+			if (align <= alignof(T))
+				return allocate(n);
+			if (n == 0)
+				return nullptr;
+
+			if (n > max_size())
+				throw std::bad_array_new_length();
 
+			void *result = heap::allocate_aligned(n * sizeof(T), align);
 			if (!result)
 				throw std::bad_alloc();
 
@@ -148,45 +209,170 @@ namespace ach
 		 * @brief Deallocate memory previously allocated with allocate
 		 *
 		 * Returns memory previously obtained from allocate back to the allocator.
-		 * For pool-based allocations, the memory is returned to the appropriate free list.
+		 * For pool-based allocations, the memory is returned to the calling thread's cache;
+		 * it may have been allocated by any thread and through any allocator specialization.
 		 * For large allocations, the memory is unmapped from the operating system.
 		 *
 		 * @param p Pointer to the memory to deallocate
-		 * @param n Number of objects the memory was allocated for; unused but required by standard
+		 * @param n Number of objects the memory was allocated for
+		 * @note The block's size class is derived from n alone, so n must be the count that was
+		 *  passed to allocate; define ACHERON_ALLOCATOR_DEBUG to have this checked
 		 * @note The behavior is undefined if p was not previously allocated by this allocator
 		 */
-		void deallocate(pointer p, size_type) noexcept
+		void deallocate(pointer p, size_type n) noexcept
 		{
-			if (!p)
-				return;
+			if constexpr (OVER_ALIGNED)
+				heap::deallocate_aligned(p, n * sizeof(T), alignof(T));
+			else
+				heap::deallocate(p, n * sizeof(T));
+		}
 
-			auto& state = get_global_state();
+		/**
+		 * @brief Deallocate memory obtained from allocate(n, align)
+		 *
+		 * @param p Pointer to the memory to deallocate
+		 * @param n Number of objects the memory was allocated for
+		 * @param align Alignment the memory was allocated with
+		 */
+		void deallocate(pointer p, size_type n, size_t align) noexcept
+		{
+			if (align <= alignof(T))
+				deallocate(p, n);
+			else
+				heap::deallocate_aligned(p, n * sizeof(T), align);
+		}
 
-			if (!BlockHeader::is_aligned(p))
-				return;
+		/**
+		 * @brief Resize memory previously allocated with allocate, moving it if needed
+		 *
+		 * Large blocks are grown by remapping their pages, so no element is ever copied and
+		 * the old and new buffers never coexist in memory.
+		 *
+		 * @param p Pointer to the memory, or nullptr to just allocate
+		 * @param old_n Number of objects the memory was allocated for
+		 * @param new_n Number of objects wanted
+		 * @return pointer The resized memory, or nullptr if new_n is zero
+		 * @throw std::bad_alloc if the memory could not be resized; p is left intact
+		 * @note The objects are moved as raw bytes; only valid if T is trivially relocatable.
+		 *  Over-aligned memory is always copied to a new block.
+		 */
+		[[nodiscard]] pointer reallocate(pointer p, size_type old_n, size_type new_n)
+		{
+			if (new_n == 0)
+			{
+				deallocate(p, old_n);
+				return nullptr;
+			}
 
-			auto *header = reinterpret_cast<BlockHeader *>(
-				reinterpret_cast<unsigned char *>(p) - sizeof(BlockHeader)
-			);
+			if (new_n > max_size())
+				throw std::bad_array_new_length();
 
-			if (!header->is_valid())
-				return;
+			if constexpr (OVER_ALIGNED)
+			{
+				pointer result = allocate(new_n);
+				if (p)
+				{
+					std::memcpy(static_cast<void *>(result), static_cast<const void *>(p), (old_n < new_n ? old_n : new_n) * sizeof(T));
+					deallocate(p, old_n);
+				}
+				return result;
+			}
 
-			if (header->is_mmap())
+			void *result = heap::reallocate(p, old_n * sizeof(T), new_n * sizeof(T));
+			if (!result)
+				throw std::bad_alloc();
+
+			return static_cast<pointer>(result);
+		}
+
+		/**
+		 * @brief Resize memory previously allocated with allocate without moving it
+		 *
+		 * @param p Pointer to the memory
+		 * @param old_n Number of objects the memory was allocated for
+		 * @param new_n Number of objects wanted
+		 * @return bool True if the memory now holds new_n objects and must be deallocated
+		 *  with that count; false if nothing changed
+		 */
+		bool try_expand(pointer p, size_type old_n, size_type new_n) noexcept
+		{
+			if (OVER_ALIGNED || !p || new_n == 0 || new_n > max_size())
+				return false;
+			return heap::try_expand(p, old_n * sizeof(T), new_n * sizeof(T));
+		}
+
+		/**
+		 * @brief Allocate memory for one object of type T, `count` times
+		 *
+		 * Node-based containers building many nodes at once use this to take whole chains of
+		 * blocks from ach::heap instead of one block per call.
+		 *
+		 * @param count Number of blocks to allocate
+		 * @param out Receives the blocks
+		 * @throw std::bad_alloc if not all blocks could be allocated; none are kept then
+		 * @note Every block is an allocation of one object; it may be released on its own with
+		 *  deallocate(p, 1) or together with others with deallocate_batch
+		 */
+		void allocate_batch(size_type count, pointer *out)
+		{
+			if constexpr (OVER_ALIGNED)
 			{
-				const size_t total_size = header->size() + sizeof(BlockHeader);
-				const size_t aligned_size = (total_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-				munmap(header, aligned_size);
+				for (size_type done = 0; done < count; ++done)
+				{
+					try
+					{
+						out[done] = allocate(1);
+					}
+					catch (...)
+					{
+						deallocate_batch(out, done);
+						throw;
+					}
+				}
 				return;
 			}
 
-			uint8_t size_class = header->size_class();
-			if (size_class >= SIZE_CLASSES)
+			void *blocks[BATCH];
+			for (size_type done = 0; done < count;)
+			{
+				const size_t wanted = count - done < BATCH ? count - done : BATCH;
+				const size_t taken = heap::allocate_batch(sizeof(T), wanted, blocks);
+				for (size_t i = 0; i < taken; ++i)
+					out[done + i] = static_cast<pointer>(blocks[i]);
+				done += taken;
+
+				if (taken < wanted)
+				{
+					deallocate_batch(out, done);
+					throw std::bad_alloc();
+				}
+			}
+		}
+
+		/**
+		 * @brief Deallocate blocks of one object each, see allocate_batch
+		 *
+		 * @param ptrs The blocks; nullptr entries are ignored
+		 * @param count Number of entries in ptrs
+		 */
+		void deallocate_batch(const pointer *ptrs, size_type count) noexcept
+		{
+			if constexpr (OVER_ALIGNED)
+			{
+				for (size_type i = 0; i < count; ++i)
+					deallocate(ptrs[i], 1);
 				return;
+			}
 
-			header->set_free(true);
-			header->next = state.free_lists[size_class];
-			state.free_lists[size_class] = header;
+			void *blocks[BATCH];
+			for (size_type done = 0; done < count;)
+			{
+				const size_t n = count - done < BATCH ? count - done : BATCH;
+				for (size_t i = 0; i < n; ++i)
+					blocks[i] = ptrs[done + i];
+				heap::deallocate_batch(blocks, n, sizeof(T));
+				done += n;
+			}
 		}
 
 		/**
@@ -203,6 +389,19 @@ namespace ach
 			return std::numeric_limits<size_type>::max() / sizeof(T);
 		}
 
+		/**
+		 * @brief Bytes the heap really takes for a block of n objects
+		 *
+		 * @param n Number of objects, as passed to allocate
+		 * @return size_t The block's size class or mapping size; zero if n is zero
+		 */
+		[[nodiscard]] size_t allocation_size(size_type n) const noexcept
+		{
+			if (n == 0)
+				return 0;
+			return OVER_ALIGNED ? heap::allocation_size(n * sizeof(T), alignof(T)) : heap::allocation_size(n * sizeof(T));
+		}
+
 		/**
 		 * @brief Construct an object at the given address
 		 *
@@ -239,309 +438,111 @@ namespace ach
 		}
 
 	private:
-		/* notes: on x86_64, the cache line is guaranteed to be 64 fixed-bytes,
-		 * however; ARM-based is implementation defined. 64 bytes is a good-enough
-		 * guess as false sharing shouldn't happen because this allocator is
-		 * designed to run on a single thread. */
-		static constexpr size_t CACHE_LINE_SIZE = 64;
-		static constexpr size_t PAGE_SIZE = 4096;
-		static constexpr size_t ALIGNMENT = CACHE_LINE_SIZE;
-
-		static constexpr size_t TINY_THRESHOLD = 64;
-		static constexpr size_t SMALL_THRESHOLD = 256;
-		static constexpr size_t MEDIUM_THRESHOLD = 4096;
-		static constexpr size_t LARGE_THRESHOLD = 1024 * 1024;
-
-		static constexpr size_t SIZE_CLASSES = 32;
-		static constexpr size_t TINY_CLASSES = 8;
-
-		static constexpr auto HEADER_MAGIC = 0xDEADBEEF12345678;
-		static constexpr uint64_t SIZE_MASK = 0x0000FFFFFFFFFFFF;
-		static constexpr uint64_t CLASS_MASK = 0x00FF000000000000;
-		static constexpr auto MAGIC_MASK = 0xF000000000000000;
-		static constexpr auto MAGIC_VALUE = 0xA000000000000000;
-		static constexpr uint64_t FREE_FLAG = 1ULL << 63;
-		static constexpr uint64_t MMAP_FLAG = 1ULL << 62;
-
-		class BlockHeader
-		{
-		public:
-			uint64_t data;
-			uint64_t magic;
-			BlockHeader *next; /* next block in the free list */
-
-			void init(const size_t size, uint8_t size_class, const bool is_free)
-			{
-				magic = HEADER_MAGIC;
-				data = (size & SIZE_MASK) |
-				       (static_cast<uint64_t>(size_class) << 48) |
-				       (static_cast<uint64_t>(is_free) << 63) |
-				       MAGIC_VALUE;
-				next = nullptr;
-			}
-
-			/* this takes like 3 cycles at worse so it should be superfast */
-			[[nodiscard]] bool is_valid() const
-			{
-				return (magic == HEADER_MAGIC) &&
-				       ((data & MAGIC_MASK) == MAGIC_VALUE) &&
-				       (size() <= (1ULL << 47));
-			}
-
-			[[nodiscard]] bool is_free() const
-			{
-				return (data & FREE_FLAG) != 0;
-			}
-
-			[[nodiscard]] bool is_mmap() const
-			{
-				return (data & MMAP_FLAG) != 0;
-			}
-
-			[[nodiscard]] size_t size() const
-			{
-				return data & SIZE_MASK;
-			}
-
-			[[nodiscard]] uint8_t size_class() const
-			{
-				return (data & CLASS_MASK) >> 48;
-			}
-
-			/* mutators */
-			void set_free(const bool is_free)
-			{
-				data = (data & ~FREE_FLAG) | (static_cast<uint64_t>(is_free) << 63);
-			}
-
-			void set_mmap(const bool is_mmap)
-			{
-				data = (data & ~MMAP_FLAG) | (static_cast<uint64_t>(is_mmap) << 62);
-			}
-
-			static bool is_aligned(const void *ptr)
-			{
-				if ((reinterpret_cast<uintptr_t>(ptr) & (ALIGNMENT - 1)) != 0)
-					return false;
-
-				const auto *header = reinterpret_cast<const BlockHeader *>(
-					static_cast<const char *>(ptr) - sizeof(BlockHeader));
-
-				return header->magic == HEADER_MAGIC;
-			}
-		};
+		static constexpr size_t BATCH = 64; /* blocks passed to ach::heap per call */
+		static constexpr bool OVER_ALIGNED = alignof(T) > heap::NATURAL_ALIGNMENT;
+	};
 
-		struct SizeClass
-		{
-			uint16_t size;   /* base size of this class */
-			uint16_t slot;   /* actual allocation size; with alignment */
-			uint16_t blocks; /* number of blocks per page */
-		};
+	template<typename T1, typename T2>
+	bool operator==(const allocator<T1> &, const allocator<T2> &) noexcept
+	{
+		return true; /* all instances are considered equal for stateless allocators */
+	}
 
-		class alignas(PAGE_SIZE) Pool
-		{
-		public:
-			uint8_t *memory; /* memory region */
-			size_t cap;      /* total capacity in bytes */
-			BlockHeader *free_list;
-			Pool *next; /* next pool in chain */
+	template<typename T1, typename T2>
+	bool operator!=(const allocator<T1> &lhs, const allocator<T2> &rhs) noexcept
+	{
+		return !(lhs == rhs);
+	}
 
-			explicit Pool(const size_t size)
-			{
-#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
-				memory = static_cast<uint8_t *>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
-				                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
-				if (memory == MAP_FAILED)
-					throw std::bad_alloc();
-#elif defined(_WIN32) || defined(_WIN64)
-                memory = static_cast<uint8_t *>(VirtualAlloc(nullptr, size,
-                                                            MEM_COMMIT | MEM_RESERVE,
-                                                            PAGE_READWRITE));
-                if (!memory)
-                    throw std::bad_alloc();
-#endif
-
-				cap = size;
-				free_list = nullptr;
-				next = nullptr;
-			}
+	/**
+	 * @brief Single-object blocks moved to and from an allocator a batch at a time
+	 *
+	 * @note Used by node-based containers on their bulk paths, e.g. copying, range inserting
+	 *  or clearing, to allocate and free nodes through allocate_batch and deallocate_batch
+	 *  when the allocator has them, and one by one otherwise. Blocks given back are reused
+	 *  by take() first; whatever is left when the batch is destroyed is deallocated. A block
+	 *  is an ordinary allocation of one object either way.
+	 * @tparam Alloc Allocator of the node type
+	 */
+	template<typename Alloc>
+	class allocation_batch
+	{
+	public:
+		using traits = std::allocator_traits<Alloc>;
+		using pointer = typename traits::pointer;
 
-			~Pool()
-			{
-				if (memory != nullptr)
-				{
-#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
-					munmap(memory, cap);
-#elif defined(_WIN32) || defined(_WIN64)
-                    VirtualFree(memory, 0, MEM_RELEASE);
-#endif
-					memory = nullptr;
-				}
-			}
-		};
+		/**
+		 * @brief Prepare to hand out about `expected` blocks from `alloc`
+		 *
+		 * @note Nothing is allocated before the first take(); asking for more than expected
+		 *  is fine, those blocks come one batch at a time as well
+		 */
+		allocation_batch(Alloc &alloc, const size_t expected) noexcept : alloc(alloc), expected(expected) {}
 
-		SizeClass size_classes[SIZE_CLASSES] = {};
-		BlockHeader *free_lists[SIZE_CLASSES] = {};
-		Pool *pools[SIZE_CLASSES] = {};
+		ACHERON_NOCOPY(allocation_batch)
+		ACHERON_NOMOVE(allocation_batch)
 
-		void init_size_classes()
+		~allocation_batch()
 		{
-			for (size_t i = 0; i < SIZE_CLASSES; ++i)
-			{
-				const size_t size = 1ULL << (i + 3); /* 8, 16, 32, ... */
-				const size_t alignment = (size > ALIGNMENT) ? size : ALIGNMENT;
-				const size_t slot_size = (size + sizeof(BlockHeader) + alignment - 1) & ~(alignment - 1);
-
-				size_classes[i].size = size;
-				size_classes[i].slot = slot_size;
-				size_classes[i].blocks = PAGE_SIZE / slot_size;
-
-				free_lists[i] = nullptr;
-				pools[i] = nullptr;
-			}
+			release();
 		}
 
-		static uint8_t get_size_class(size_t size)
+		/**
+		 * @brief Take the next block
+		 *
+		 * @throw std::bad_alloc if the allocator is out of memory
+		 */
+		pointer take()
 		{
-			if (size <= TINY_THRESHOLD)
-			{
-				return (size - 1) >> 3; /* 8 bytes increments */
-			}
-
-			/* find the next power of 2 ceiling */
-			size_t n = size - 1;
-			n |= n >> 1;
-			n |= n >> 2;
-			n |= n >> 4;
-			n |= n >> 8;
-			n |= n >> 16;
-			n |= n >> 32;
-
-			uint8_t class_index = (63 - __builtin_clzll(n + 1)) - 3; /* log2 - 3 */
-			if (class_index >= SIZE_CLASSES)
-				return SIZE_CLASSES - 1;
-
-			return class_index;
+			if (count == 0)
+				refill();
+			return blocks[--count];
 		}
 
-		void allocate_pool(uint8_t size_class)
+		/**
+		 * @brief Give back a block of one object; it need not have come from this batch
+		 */
+		void give(pointer p) noexcept
 		{
-			auto& state = get_global_state();
-
-			Pool *new_pool = new Pool(PAGE_SIZE);
+			if (count == CAPACITY)
+				release();
+			blocks[count++] = p;
+		}
 
-			new_pool->next = state.pools[size_class];
-			state.pools[size_class] = new_pool;
+	private:
+		static constexpr size_t CAPACITY = 64;
 
-			/* make free list */
-			const SizeClass &sc = state.size_classes[size_class];
-			const size_t block_size = sc.slot;
-			const size_t num_blocks = sc.blocks;
+		Alloc &alloc;
+		size_t expected;
+		size_t count = 0;
+		pointer blocks[CAPACITY];
 
-			for (size_t i = 0; i < num_blocks; ++i)
-			{
-				auto *header = reinterpret_cast<BlockHeader *>(new_pool->memory + i * block_size);
-				header->init(sc.size, size_class, true);
-				header->next = state.free_lists[size_class];
-				state.free_lists[size_class] = header;
-			}
-		}
-
-		void *allocate_from_size_class(uint8_t size_class)
+		void refill()
 		{
-			auto& state = get_global_state();
-
-			if (state.free_lists[size_class])
+			const size_t wanted = expected == 0 ? 1 : expected < CAPACITY ? expected : CAPACITY;
+			if constexpr (batch_allocator<Alloc>)
 			{
-				BlockHeader *header = state.free_lists[size_class];
-				state.free_lists[size_class] = header->next;
-				header->set_free(false);
-				return reinterpret_cast<char *>(header) + sizeof(BlockHeader);
+				alloc.allocate_batch(wanted, blocks);
+				count = wanted;
 			}
-
-			if (!state.pools[size_class] || state.pools[size_class]->free_list == nullptr)
-				allocate_pool(size_class);
-
-			if (state.free_lists[size_class])
+			else
 			{
-				BlockHeader *header = state.free_lists[size_class];
-				state.free_lists[size_class] = header->next;
-				header->set_free(false);
-				return reinterpret_cast<char *>(header) + sizeof(BlockHeader);
+				for (; count < wanted; ++count)
+					blocks[count] = traits::allocate(alloc, 1);
 			}
-
-			return nullptr; /* failed */
-		}
-
-		static void *allocate_large(size_t size)
-		{
-			constexpr auto header_size = sizeof(BlockHeader);
-			const size_t total_size = size + header_size;
-			const size_t aligned_size = (total_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-
-#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
-			void *mem = mmap(nullptr, aligned_size,
-			                 PROT_READ | PROT_WRITE,
-			                 MAP_PRIVATE | MAP_ANONYMOUS,
-			                 -1, 0);
-			if (mem == MAP_FAILED)
-				return nullptr;
-#elif defined(_WIN32) || defined(_WIN64)
-            void *mem = VirtualAlloc(nullptr, aligned_size,
-                                    MEM_COMMIT | MEM_RESERVE,
-                                    PAGE_READWRITE);
-            if (!mem)
-                return nullptr;
-#endif
-
-			auto *header = static_cast<BlockHeader *>(mem);
-			header->init(size, 255, false);
-			header->set_mmap(true);
-			return static_cast<char *>(mem) + header_size;
+			expected -= wanted < expected ? wanted : expected;
 		}
 
-		struct GlobalAllocatorState
+		void release() noexcept
 		{
-			SizeClass size_classes[SIZE_CLASSES] = {};
-			BlockHeader *free_lists[SIZE_CLASSES] = {};
-			Pool *pools[SIZE_CLASSES] = {};
-			bool initialized = false;
-
-			GlobalAllocatorState()
+			if constexpr (batch_allocator<Alloc>)
+				alloc.deallocate_batch(blocks, count);
+			else
 			{
-				for (size_t i = 0; i < SIZE_CLASSES; ++i)
-				{
-					const size_t size = 1ULL << (i + 3);
-					const size_t alignment = (size > ALIGNMENT) ? size : ALIGNMENT;
-					const size_t slot_size = (size + sizeof(BlockHeader) + alignment - 1) & ~(alignment - 1);
-
-					size_classes[i].size = size;
-					size_classes[i].slot = slot_size;
-					size_classes[i].blocks = PAGE_SIZE / slot_size;
-
-					free_lists[i] = nullptr;
-					pools[i] = nullptr;
-				}
-				initialized = true;
+				for (size_t i = 0; i < count; ++i)
+					traits::deallocate(alloc, blocks[i], 1);
 			}
-		};
-
-		static GlobalAllocatorState &get_global_state()
-		{
-			static GlobalAllocatorState state;
-			return state;
+			count = 0;
 		}
 	};
-
-	template<typename T1, typename T2>
-	bool operator==(const allocator<T1> &, const allocator<T2> &) noexcept
-	{
-		return true; /* all instances are considered equal for stateless allocators */
-	}
-
-	template<typename T1, typename T2>
-	bool operator!=(const allocator<T1> &lhs, const allocator<T2> &rhs) noexcept
-	{
-		return !(lhs == rhs);
-	}
 }
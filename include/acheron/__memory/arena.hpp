@@ -0,0 +1,285 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <acheron/__libdef.hpp>
+#include <acheron/__memory/heap.hpp>
+
+namespace ach
+{
+	/**
+	 * @brief Bump-pointer arena for memory that dies all at once
+	 *
+	 * @note Allocation moves a pointer forward inside the current chunk; deallocation does
+	 *  nothing. reset() rewinds to the first chunk in O(1) and keeps every chunk for the next
+	 *  round, release() hands them all back to ach::heap.
+	 *
+	 * @note Chunks come from ach::heap, so small arenas are carved out of the shared spans and
+	 *  big ones are mapped directly. Each new chunk is twice the size of the previous one, up to
+	 *  MAX_CHUNK_SIZE; a request that does not fit gets a chunk of its own.
+	 *
+	 * @note Not thread-safe; use one arena per thread or per request. Objects living in the arena
+	 *  are not destroyed by reset() or release(); destroy them (or their containers) first.
+	 */
+	class arena
+	{
+	public:
+		static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+		static constexpr size_t MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+		/**
+		 * @brief Create an empty arena
+		 *
+		 * @param chunk_size Size of the first chunk; nothing is allocated until first use
+		 */
+		explicit arena(const size_t chunk_size = DEFAULT_CHUNK_SIZE) noexcept
+			: next_size(chunk_size < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : chunk_size) {}
+
+		ACHERON_NOCOPY(arena)
+		ACHERON_NOMOVE(arena)
+
+		~arena()
+		{
+			release();
+		}
+
+		/**
+		 * @brief Allocate `bytes` bytes aligned to `align`
+		 *
+		 * @param bytes Number of bytes requested
+		 * @param align Required alignment; must be a power of two
+		 * @return void* The memory, or nullptr if no chunk could be obtained
+		 */
+		[[nodiscard]] void *allocate(const size_t bytes, const size_t align = alignof(std::max_align_t))
+		{
+			/* an arena without a chunk has cursor == limit == 0, where even a zero-byte
+			   request would fit and come back as nullptr */
+			const uintptr_t p = (cursor + align - 1) & ~(align - 1);
+			if (ACHERON_LIKELY(cursor && p <= limit && bytes <= limit - p))
+			{
+				cursor = p + bytes;
+				return reinterpret_cast<void *>(p);
+			}
+
+			return allocate_slow(bytes, align);
+		}
+
+		/**
+		 * @brief Deallocation is a no-op; memory is reclaimed by reset() or release()
+		 */
+		void deallocate(void *, size_t) noexcept {}
+
+		/**
+		 * @brief Make all chunks available again without returning them to the heap
+		 *
+		 * @note Every pointer handed out so far becomes dangling
+		 */
+		void reset() noexcept
+		{
+			current = first;
+			if (current)
+				enter(current);
+		}
+
+		/**
+		 * @brief Return every chunk to the heap
+		 *
+		 * @note Every pointer handed out so far becomes dangling
+		 */
+		void release() noexcept
+		{
+			for (Chunk *chunk = first; chunk;)
+			{
+				Chunk *next = chunk->next;
+				heap::deallocate(chunk, chunk->size);
+				chunk = next;
+			}
+
+			first = current = nullptr;
+			cursor = limit = 0;
+		}
+
+		/**
+		 * @brief Total size of the chunks owned by the arena, in bytes
+		 */
+		[[nodiscard]] size_t capacity() const noexcept
+		{
+			size_t total = 0;
+			for (const Chunk *chunk = first; chunk; chunk = chunk->next)
+				total += chunk->size;
+			return total;
+		}
+
+	private:
+		static constexpr size_t MIN_CHUNK_SIZE = 1024;
+
+		/* chunks form a list in allocation order; the ones after `current` are free */
+		struct Chunk
+		{
+			Chunk *next;
+			size_t size; /* including this header */
+		};
+
+		Chunk *first = nullptr;
+		Chunk *current = nullptr;
+		uintptr_t cursor = 0;
+		uintptr_t limit = 0;
+		size_t next_size;
+
+		void enter(Chunk *chunk) noexcept
+		{
+			cursor = reinterpret_cast<uintptr_t>(chunk + 1);
+			limit = reinterpret_cast<uintptr_t>(chunk) + chunk->size;
+		}
+
+		ACHERON_NOINLINE void *allocate_slow(const size_t bytes, const size_t align)
+		{
+			const size_t needed = sizeof(Chunk) + bytes + align;
+			if (needed < bytes)
+				return nullptr; /* overflow */
+
+			/* walk the chunks kept by reset() before asking the heap for a new one */
+			Chunk *chunk = current ? current->next : first;
+			while (chunk && chunk->size < needed)
+				chunk = chunk->next;
+
+			if (!chunk)
+			{
+				const size_t size = needed > next_size ? needed : next_size;
+				chunk = static_cast<Chunk *>(heap::allocate(size));
+				if (!chunk)
+					return nullptr;
+				chunk->size = size;
+				if (next_size < MAX_CHUNK_SIZE)
+					next_size *= 2;
+
+				/* keep the list in the order chunks are entered */
+				Chunk **link = current ? &current->next : &first;
+				chunk->next = *link;
+				*link = chunk;
+			}
+
+			current = chunk;
+			enter(chunk);
+
+			const uintptr_t p = (cursor + align - 1) & ~(align - 1);
+			cursor = p + bytes;
+			return reinterpret_cast<void *>(p);
+		}
+	};
+
+	/**
+	 * @brief Allocator drawing from an ach::arena
+	 *
+	 * @note Same interface as ach::allocator<T>, so every ach container accepts it. It holds a
+	 *  reference to its arena, so containers must be constructed with an instance, and the arena
+	 *  has to outlive them. deallocate is a no-op.
+	 * @tparam T Type of objects to allocate
+	 */
+	template<typename T>
+	class arena_allocator
+	{
+	public:
+		using value_type = T;
+		using pointer = T *;
+		using const_pointer = const T *;
+		using reference = T &;
+		using const_reference = const T &;
+		using size_type = size_t;
+		using difference_type = ptrdiff_t;
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+		using is_always_equal = std::false_type;
+
+		template<typename U>
+		struct rebind
+		{
+			using other = arena_allocator<U>;
+		};
+
+		/**
+		 * @brief Create an allocator drawing from `a`
+		 */
+		constexpr arena_allocator(arena &a) noexcept : source(&a) {}
+
+		constexpr arena_allocator(const arena_allocator &other) noexcept = default;
+
+		template<typename U>
+		constexpr arena_allocator(const arena_allocator<U> &other) noexcept : source(other.source) {}
+
+		/**
+		 * @brief Allocate memory for n objects of type T
+		 *
+		 * @param n Number of objects to allocate memory for
+		 * @return pointer The pointer to the allocated memory, or nullptr if n is zero
+		 * @throw std::bad_alloc if the arena could not grow
+		 */
+		[[nodiscard]] pointer allocate(size_type n)
+		{
+			if (n == 0)
+				return nullptr;
+
+			if (n > max_size())
+				throw std::bad_array_new_length();
+
+			void *result = source->allocate(n * sizeof(T), alignof(T));
+			if (!result)
+				throw std::bad_alloc();
+
+			return static_cast<pointer>(result);
+		}
+
+		/**
+		 * @brief No-op; the memory is reclaimed when the arena is reset or released
+		 */
+		void deallocate(pointer, size_type) noexcept {}
+
+		[[nodiscard]] size_type max_size() const noexcept
+		{
+			return std::numeric_limits<size_type>::max() / sizeof(T);
+		}
+
+		template<typename U, typename... Args>
+		void construct(U *p, Args &&... args) noexcept(std::is_nothrow_constructible_v<U, Args...>)
+		{
+			::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+		}
+
+		template<typename U>
+		void destroy(U *p) noexcept(std::is_nothrow_destructible_v<U>)
+		{
+			p->~U();
+		}
+
+		/**
+		 * @brief The arena this allocator draws from
+		 */
+		[[nodiscard]] arena &resource() const noexcept
+		{
+			return *source;
+		}
+
+	private:
+		template<typename U>
+		friend class arena_allocator;
+
+		arena *source;
+	};
+
+	template<typename T1, typename T2>
+	bool operator==(const arena_allocator<T1> &lhs, const arena_allocator<T2> &rhs) noexcept
+	{
+		return &lhs.resource() == &rhs.resource();
+	}
+
+	template<typename T1, typename T2>
+	bool operator!=(const arena_allocator<T1> &lhs, const arena_allocator<T2> &rhs) noexcept
+	{
+		return !(lhs == rhs);
+	}
+}
@@ -0,0 +1,2382 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <acheron/__atomic/atomic.hpp>
+#include <acheron/__atomic/spin_lock.hpp>
+#include <acheron/__libdef.hpp>
+#ifndef ACHERON_ALLOCATOR_STATS
+/* set to 0 to compile the allocation counters out of the hot paths */
+#define ACHERON_ALLOCATOR_STATS 1
+#endif
+#ifndef ACHERON_ALLOCATOR_SAMPLING
+#if __has_include(<execinfo.h>)
+/* set to 0 to compile the sampling countdown out of the allocation path */
+#define ACHERON_ALLOCATOR_SAMPLING 1
+#else
+#define ACHERON_ALLOCATOR_SAMPLING 0
+#endif
+#endif
+#if ACHERON_ALLOCATOR_SAMPLING
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <execinfo.h>
+#include <utility>
+#endif
+#ifdef ACHERON_ALLOCATOR_DEBUG
+#include <cstdio>
+#include <cstdlib>
+#endif
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+/* we compile for Unix e.g. Linux, macOS and so on */
+#include <sys/mman.h>
+#elif defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#error "Windows is not supported yet, but will be soon; hopefully"
+#else /* not supported at the moment, but will be soon; hopefully */
+#error "your OS not supported at the moment, but will be soon; hopefully"
+#endif
+
+namespace ach
+{
+	/**
+	 * @brief Process-wide, type-independent heap backing every ach::allocator<T>
+	 *
+	 * @note All allocator specializations forward here in bytes, so memory released by one
+	 *  container type is immediately reusable by any other one. Requests below 1 MiB are served
+	 *  from size-class spans; larger ones are mapped directly from the operating system.
+	 *
+	 * @note Memory for spans is reserved in 4 MiB segments aligned to their own size, so the
+	 *  span owning any small block is found by masking its address. A segment is cut into
+	 *  64 KiB slices and every span covers 1 to 32 slices, enough for at least a handful of
+	 *  blocks of its class. Blocks are carved lazily, so untouched parts of a span never
+	 *  become resident.
+	 *
+	 * @note Blocks carry no header: a span knows the size class of everything it holds, and a
+	 *  free block stores the free-list link in its own first word. Blocks are packed back to
+	 *  back, so each one is aligned to the largest power of two dividing its class size.
+	 *
+	 * @note A span whose blocks have all come back is given up right away. Its slices stay
+	 *  committed, ready for the next span, until more than DIRTY_LIMIT bytes pile up; then
+	 *  they are handed back with madvise and segments left without any span are unmapped.
+	 *  ach::allocator_trim does the same on demand. Freed large blocks are likewise kept in a
+	 *  small cache for a while, so buffers that are dropped and regrown do not cost a
+	 *  mmap/munmap pair every round.
+	 *
+	 * @note Every mapping is aligned to 4 MiB, so huge pages can back it without waste; see
+	 *  ach::allocator_configure for the huge page and pre-faulting policies.
+	 *
+	 * @note Allocations can be sampled for heap profiling: every sample_interval bytes on
+	 *  average, the call stack of an allocation is recorded until the block is freed. See
+	 *  ach::allocator_profile.
+	 *
+	 * @note Thread-safe. Every thread owns a small cache of free blocks per size class and the
+	 *  spans it carves them from, so neither allocating nor freeing its own blocks takes a
+	 *  lock. A block freed by another thread is pushed onto the owner's remote stack with a
+	 *  single CAS and collected in one sweep at the owner's next refill, so memory always
+	 *  goes back to the thread that allocates from it. The central lock is only taken to hand
+	 *  out or give up whole spans; spans of an exited thread are adopted by the next one.
+	 */
+	class heap
+	{
+	public:
+		heap() = delete;
+
+		/**
+		 * @brief Allocate a block of at least `bytes` bytes
+		 *
+		 * @param bytes Number of bytes requested; must be non-zero
+		 * @return void* The block, or nullptr if the operating system is out of memory
+		 */
+		[[nodiscard]] static void *allocate(const size_t bytes)
+		{
+		#if ACHERON_ALLOCATOR_SAMPLING
+			if (ACHERON_UNLIKELY((thread_cache.sample_countdown -= static_cast<int64_t>(bytes)) < 0))
+				return allocate_sampled(bytes);
+		#endif
+			if (bytes >= LARGE_THRESHOLD)
+				return allocate_large(bytes);
+			return allocate_from_size_class(get_size_class(bytes));
+		}
+
+		/**
+		 * @brief Return a block previously obtained from allocate
+		 *
+		 * @param p Pointer to the block; nullptr is ignored
+		 * @param bytes Size the block was requested with
+		 * @note The size class is computed from `bytes` alone, so nothing but the thread's
+		 *  cache is touched; passing a different size than the block was allocated with is
+		 *  undefined. Define ACHERON_ALLOCATOR_DEBUG to have every call checked.
+		 * @note The block may be released from any thread, not just the one that allocated it
+		 */
+		static void deallocate(void *p, const size_t bytes) noexcept
+		{
+			if (!p)
+				return;
+
+		#ifdef ACHERON_ALLOCATOR_DEBUG
+			validate(p, bytes);
+		#endif
+
+			if (ACHERON_UNLIKELY(bytes >= LARGE_THRESHOLD))
+			{
+				free_large(reinterpret_cast<Segment *>(static_cast<uint8_t *>(p) - PAGE_SIZE));
+				return;
+			}
+
+			free_to_size_class(static_cast<FreeBlock *>(p), get_size_class(bytes));
+		}
+
+		/**
+		 * @brief Return a block whose requested size is not known
+		 *
+		 * @param p Pointer to the block; nullptr is ignored
+		 * @note Slower than the sized overload since the size class has to be read from the
+		 *  block's span; pointers that never came from this heap are ignored
+		 */
+		static void deallocate(void *p) noexcept
+		{
+			if (!p)
+				return;
+
+			Segment *segment = segment_of(p);
+			if (segment->magic != SEGMENT_MAGIC)
+				return;
+
+			if (segment->mapped)
+			{
+				free_large(segment);
+				return;
+			}
+
+			free_to_size_class(static_cast<FreeBlock *>(p), span_of(p)->size_class);
+		}
+
+		/**
+		 * @brief Bytes a block requested with `bytes` takes from the heap
+		 *
+		 * @note The size of its size class, or for large blocks their whole mapping including
+		 *  the header page; mappings rounded up to huge pages count as regular ones
+		 */
+		[[nodiscard]] static size_t allocation_size(const size_t bytes) noexcept
+		{
+			if (bytes >= LARGE_THRESHOLD)
+				return large_mapping(bytes);
+			return size_classes.classes[get_size_class(bytes)].size;
+		}
+
+		/**
+		 * @brief Bytes a block requested from allocate_aligned takes from the heap
+		 *
+		 * @return size_t Zero if the alignment is not supported
+		 */
+		[[nodiscard]] static size_t allocation_size(const size_t bytes, const size_t align) noexcept
+		{
+			const size_t size = aligned_size(bytes, align);
+			if (size == 0)
+				return 0;
+			if (fits_size_class(size, align))
+				return allocation_size(size);
+			return large_mapping(size + align - PAGE_SIZE);
+		}
+
+		/* allocate returns blocks aligned to any power of two up to this that divides the request */
+		static constexpr size_t NATURAL_ALIGNMENT = 16;
+		/* largest alignment allocate_aligned accepts; half a segment */
+		static constexpr size_t MAX_ALIGNMENT = 2 * 1024 * 1024;
+
+		/**
+		 * @brief Allocate a block of at least `bytes` bytes aligned to `align`
+		 *
+		 * @param bytes Number of bytes requested; must be non-zero
+		 * @param align Required alignment; a power of two up to MAX_ALIGNMENT
+		 * @return void* The block, or nullptr if the operating system is out of memory or the
+		 *  alignment is not supported
+		 * @note Costs no padding up to the slice size: the request goes to the smallest size
+		 *  class that is a multiple of `align`, and such blocks are aligned to it. Large blocks
+		 *  are page aligned; bigger alignments start `align` bytes into their own mapping.
+		 * @note Release with deallocate_aligned and the same size and alignment, or with the
+		 *  unsized deallocate
+		 */
+		[[nodiscard]] static void *allocate_aligned(const size_t bytes, const size_t align)
+		{
+			const size_t size = aligned_size(bytes, align);
+			if (size == 0)
+				return nullptr;
+
+			if (ACHERON_LIKELY(fits_size_class(size, align)))
+				return allocate(size);
+
+			/* the offset stays within the first segment, so masking still finds the header */
+			auto *block = static_cast<uint8_t *>(allocate_large(size + align - PAGE_SIZE));
+			return block ? block - PAGE_SIZE + align : nullptr;
+		}
+
+		/**
+		 * @brief Return a block obtained from allocate_aligned
+		 *
+		 * @param p Pointer to the block; nullptr is ignored
+		 * @param bytes Size the block was requested with
+		 * @param align Alignment the block was requested with
+		 */
+		static void deallocate_aligned(void *p, const size_t bytes, const size_t align) noexcept
+		{
+			if (!p)
+				return;
+
+			const size_t size = aligned_size(bytes, align);
+			if (ACHERON_LIKELY(fits_size_class(size, align)))
+			{
+				deallocate(p, size);
+				return;
+			}
+
+		#ifdef ACHERON_ALLOCATOR_DEBUG
+			const Segment *segment = segment_of(p);
+			if (segment->magic != SEGMENT_MAGIC || !segment->mapped ||
+			    p != reinterpret_cast<const uint8_t *>(segment) + align)
+				invalid_free(p, bytes, "pointer is not an over-aligned large block");
+		#endif
+			free_large(segment_of(p));
+		}
+
+		/**
+		 * @brief Allocate `blocks` blocks of `bytes` bytes each
+		 *
+		 * @param bytes Size of every block; must be non-zero
+		 * @param blocks Number of blocks wanted
+		 * @param out Receives the blocks
+		 * @return size_t Number of blocks stored in out; less than `blocks` only if the
+		 *  operating system is out of memory
+		 * @note Empties the thread's cache in one sweep and carves the rest from the spans the
+		 *  thread owns. The blocks are ordinary ones and may be released one by one or in
+		 *  batches.
+		 */
+		static size_t allocate_batch(const size_t bytes, const size_t blocks, void **out)
+		{
+			if (bytes >= LARGE_THRESHOLD)
+			{
+				for (size_t i = 0; i < blocks; ++i)
+				{
+					if (!(out[i] = allocate_large(bytes)))
+						return i;
+				}
+				return blocks;
+			}
+
+			const uint8_t size_class = get_size_class(bytes);
+			ThreadCache &cache = thread_cache;
+			if (ACHERON_UNLIKELY(cache.state != ThreadCache::ACTIVE) && !activate_thread_cache())
+			{
+				for (size_t i = 0; i < blocks; ++i)
+				{
+					if (!(out[i] = allocate_unowned(size_class)))
+						return i;
+				}
+				return blocks;
+			}
+
+			FreeBlock *block = cache.free_lists[size_class];
+			size_t taken = 0;
+			for (; taken < blocks && block; block = block->next)
+				out[taken++] = block;
+			cache.free_lists[size_class] = block;
+			cache.counts[size_class] -= static_cast<uint32_t>(taken);
+
+			if (taken < blocks)
+			{
+				collect_remote_frees(cache);
+				FreeBlock *first = nullptr;
+				take_blocks(cache, size_class, blocks - taken, blocks - taken, first);
+				for (; first; first = first->next)
+					out[taken++] = first;
+			}
+
+		#if ACHERON_ALLOCATOR_STATS
+			count(cache.allocations[size_class], taken);
+		#endif
+		#if ACHERON_ALLOCATOR_SAMPLING
+			/* at most one sample per batch, standing for a single block */
+			if (ACHERON_UNLIKELY((cache.sample_countdown -= static_cast<int64_t>(bytes * taken)) < 0) && taken)
+			{
+				if (const size_t interval = next_sample(cache))
+					record_sample(out[0], bytes, interval);
+			}
+		#endif
+			return taken;
+		}
+
+		/**
+		 * @brief Return `blocks` blocks of `bytes` bytes each
+		 *
+		 * @param ptrs The blocks; nullptr entries are ignored
+		 * @param blocks Number of entries in ptrs
+		 * @param bytes Size every block was requested with
+		 * @note Same contract as the sized deallocate; blocks may come from allocate or
+		 *  allocate_batch alike. An overflowing thread cache is drained once at the end.
+		 */
+		static void deallocate_batch(void *const *ptrs, const size_t blocks, const size_t bytes) noexcept
+		{
+			if (bytes >= LARGE_THRESHOLD)
+			{
+				for (size_t i = 0; i < blocks; ++i)
+					deallocate(ptrs[i], bytes);
+				return;
+			}
+
+		#ifdef ACHERON_ALLOCATOR_DEBUG
+			for (size_t i = 0; i < blocks; ++i)
+			{
+				if (ptrs[i])
+					validate(ptrs[i], bytes);
+			}
+		#endif
+
+			const uint8_t size_class = get_size_class(bytes);
+			ThreadCache &cache = thread_cache;
+			if (ACHERON_UNLIKELY(cache.state != ThreadCache::ACTIVE) && !activate_thread_cache())
+			{
+				for (size_t i = 0; i < blocks; ++i)
+				{
+					if (ptrs[i])
+						free_to_size_class(static_cast<FreeBlock *>(ptrs[i]), size_class);
+				}
+				return;
+			}
+
+			size_t freed = 0;
+			size_t kept = 0;
+			for (size_t i = 0; i < blocks; ++i)
+			{
+				auto *block = static_cast<FreeBlock *>(ptrs[i]);
+				if (!block)
+					continue;
+
+				++freed;
+				Span *span = span_of(block);
+			#if ACHERON_ALLOCATOR_SAMPLING
+				if (ACHERON_UNLIKELY(span->sampled.load(memory_order::relaxed) & sample_bit(block)))
+					forget_sample(block);
+			#endif
+				RemoteStack *owner = span->owner.load(memory_order::relaxed);
+				if (owner != cache.remote)
+				{
+					free_foreign(block, owner);
+					continue;
+				}
+				block->next = cache.free_lists[size_class];
+				cache.free_lists[size_class] = block;
+				++kept;
+			}
+		#if ACHERON_ALLOCATOR_STATS
+			count(cache.frees[size_class], freed);
+		#else
+			(void) freed;
+		#endif
+
+			const size_t batch = size_classes.classes[size_class].batch;
+			cache.counts[size_class] += static_cast<uint32_t>(kept);
+			if (cache.counts[size_class] > 2 * batch)
+				drain_thread_cache(size_class, cache.counts[size_class] - batch);
+		}
+
+		/**
+		 * @brief Resize a block without moving it
+		 *
+		 * @param p Block obtained from allocate; must not be nullptr
+		 * @param old_bytes Size the block was requested with
+		 * @param new_bytes Size wanted
+		 * @return bool True if the block now holds `new_bytes`; it must from then on be released
+		 *  with that size. False if nothing changed.
+		 * @note Succeeds when both sizes fall into the same size class, when a large block
+		 *  shrinks, and when a large block grows into free address space right after it
+		 */
+		static bool try_expand(void *p, const size_t old_bytes, const size_t new_bytes) noexcept
+		{
+			if (old_bytes < LARGE_THRESHOLD)
+				return new_bytes < LARGE_THRESHOLD && get_size_class(new_bytes) == get_size_class(old_bytes);
+			if (new_bytes < LARGE_THRESHOLD)
+				return false;
+
+			auto *segment = reinterpret_cast<Segment *>(static_cast<uint8_t *>(p) - PAGE_SIZE);
+			const size_t old_mapped = segment->mapped;
+			const size_t new_mapped = large_mapping(new_bytes);
+			if (segment->hugetlb) /* pool pages cannot be split or extended; use the slack */
+				return new_mapped <= old_mapped;
+			if (new_mapped <= old_mapped)
+			{
+				if (new_mapped < old_mapped)
+					munmap(reinterpret_cast<uint8_t *>(segment) + new_mapped, old_mapped - new_mapped);
+				resize_large(segment, old_mapped, new_mapped);
+				return true;
+			}
+
+		#ifdef MREMAP_MAYMOVE
+			/* without MREMAP_MAYMOVE the kernel only grows the mapping where it stands */
+			if (mremap(segment, old_mapped, new_mapped, 0) != MAP_FAILED)
+			{
+				resize_large(segment, old_mapped, new_mapped);
+				prepare_growth(segment, old_mapped, new_mapped);
+				return true;
+			}
+		#endif
+			return false;
+		}
+
+		/**
+		 * @brief Resize a block, moving it if it cannot be resized in place
+		 *
+		 * @param p Block obtained from allocate, or nullptr to just allocate
+		 * @param old_bytes Size the block was requested with
+		 * @param new_bytes Size wanted; must be non-zero
+		 * @return void* The resized block, or nullptr on failure, in which case p is left intact
+		 * @note The contents are moved as raw bytes, so only use this for trivially relocatable
+		 *  data. Large blocks are moved by remapping their pages, never by copying them.
+		 */
+		[[nodiscard]] static void *reallocate(void *p, const size_t old_bytes, const size_t new_bytes)
+		{
+			if (!p)
+				return allocate(new_bytes);
+
+			if (try_expand(p, old_bytes, new_bytes))
+				return p;
+
+		#ifdef MREMAP_MAYMOVE
+			if (old_bytes >= LARGE_THRESHOLD && new_bytes >= LARGE_THRESHOLD)
+			{
+				if (void *moved = move_large(p, new_bytes))
+				{
+				#if ACHERON_ALLOCATOR_SAMPLING
+					if (segment_of(moved)->sampled)
+						move_sample(p, moved);
+				#endif
+					return moved;
+				}
+			}
+		#endif
+
+			void *result = allocate(new_bytes);
+			if (!result)
+				return nullptr;
+
+			std::memcpy(result, p, old_bytes < new_bytes ? old_bytes : new_bytes);
+			deallocate(p, old_bytes);
+			return result;
+		}
+
+		/**
+		 * @brief Give free memory back to the operating system
+		 *
+		 * @param keep_bytes Free but committed bytes that may stay around for reuse
+		 * @return size_t Number of bytes returned to the operating system
+		 * @note Flushes the calling thread's cache, the blocks other threads freed to it and
+		 *  the large block cache first; blocks cached by other threads are only returned once
+		 *  those threads drain or exit
+		 * @note Does nothing while the heap is pinned, see config::pinned
+		 */
+		static size_t trim(const size_t keep_bytes)
+		{
+			auto& state = get_central_state();
+			if (state.pinned.load(memory_order::relaxed))
+				return 0;
+
+			ThreadCache &cache = thread_cache;
+			if (cache.state == ThreadCache::ACTIVE)
+			{
+				collect_remote_frees(cache);
+				for (size_t i = 0; i < SIZE_CLASSES; ++i)
+					drain_thread_cache(static_cast<uint8_t>(i), cache.counts[i]);
+			}
+
+			size_t released;
+			Segment *expired;
+			{
+				std::lock_guard guard(state.large_lock);
+				released = state.large_cached_bytes;
+				expired = expire_large(milliseconds(), 0);
+			}
+			unmap_large(expired);
+
+			std::lock_guard guard(state.lock);
+			return released + purge(keep_bytes, true);
+		}
+
+		/**
+		 * @brief Acquire the memory for `count` blocks of `bytes` bytes ahead of time
+		 *
+		 * @param bytes Size of the blocks to prepare for; must be non-zero
+		 * @param count Number of blocks
+		 * @return size_t Number of blocks reserved; less than `count` only if the operating
+		 *  system is out of memory
+		 * @note The blocks are allocated together, their pages faulted in, and freed again.
+		 *  The calling thread's cache keeps a batch of them; the rest stays committed in the
+		 *  spans, so later allocations by any thread pay neither for mmap nor for page faults.
+		 *  Large blocks go to the large block cache, as far as large_cache_limit allows.
+		 * @note Reserved memory is free memory, and purged or decayed like any other unless the
+		 *  heap is pinned; see config::pinned
+		 */
+		static size_t reserve(const size_t bytes, const size_t count)
+		{
+			/* every block is held until the end, linked through its first word, or the next
+			 * allocation would just hand back the one freed before */
+			FreeBlock *reserved = nullptr;
+			size_t taken = 0;
+
+			if (bytes >= LARGE_THRESHOLD)
+			{
+				for (; taken < count; ++taken)
+				{
+					auto *block = static_cast<FreeBlock *>(allocate_large(bytes));
+					if (!block)
+						break;
+					const Segment *segment = segment_of(block);
+					populate(reinterpret_cast<uint8_t *>(block), segment->mapped - PAGE_SIZE);
+					block->next = reserved;
+					reserved = block;
+				}
+
+				while (reserved)
+				{
+					FreeBlock *next = reserved->next;
+					deallocate(reserved, bytes);
+					reserved = next;
+				}
+				return taken;
+			}
+
+			/* blocks are mostly carved back to back, so adjacent ones are faulted in together */
+			const size_t size = size_classes.classes[get_size_class(bytes)].size;
+			uint8_t *run = nullptr;
+			size_t run_size = 0;
+			void *blocks[RESERVE_BATCH];
+			while (taken < count)
+			{
+				const size_t wanted = count - taken < RESERVE_BATCH ? count - taken : RESERVE_BATCH;
+				const size_t got = allocate_batch(bytes, wanted, blocks);
+				for (size_t i = 0; i < got; ++i)
+				{
+					auto *block = static_cast<uint8_t *>(blocks[i]);
+					if (block == run + run_size)
+						run_size += size;
+					else if (block + size == run)
+					{
+						run = block;
+						run_size += size;
+					}
+					else
+					{
+						if (run)
+							prefault(run, run_size);
+						run = block;
+						run_size = size;
+					}
+
+					static_cast<FreeBlock *>(blocks[i])->next = reserved;
+					reserved = static_cast<FreeBlock *>(blocks[i]);
+				}
+
+				taken += got;
+				if (got < wanted)
+					break;
+			}
+			if (run)
+				prefault(run, run_size);
+
+			while (reserved)
+			{
+				size_t n = 0;
+				for (; reserved && n < RESERVE_BATCH; reserved = reserved->next)
+					blocks[n++] = reserved;
+				deallocate_batch(blocks, n, bytes);
+			}
+			return taken;
+		}
+
+		/**
+		 * @brief How memory mapped by the heap is backed by huge pages
+		 */
+		enum class huge_page_policy : uint8_t
+		{
+			none,        /* regular pages only */
+			transparent, /* madvise(MADV_HUGEPAGE), letting the kernel use transparent huge pages */
+			hugetlb      /* large blocks from the reserved pool with MAP_HUGETLB, the rest as transparent */
+		};
+
+		/**
+		 * @brief Policies applied to memory mapped from the operating system, see ach::allocator_configure
+		 */
+		struct config
+		{
+			huge_page_policy huge_pages = huge_page_policy::none;
+			size_t huge_page_threshold = HUGE_PAGE_SIZE; /* smaller mappings keep regular pages */
+			bool populate = false;                       /* pre-fault large blocks when mapped */
+			size_t large_cache_limit = LARGE_CACHE_LIMIT; /* freed large blocks kept for reuse, in bytes */
+			uint32_t large_cache_decay_ms = LARGE_CACHE_DECAY_MS; /* how long a freed large block is kept */
+			size_t sample_interval = 0; /* average bytes between sampled allocations, zero for none; needs ACHERON_ALLOCATOR_SAMPLING */
+			bool pinned = false;        /* keep free memory committed: no purging, no decay, trim() does nothing */
+		};
+
+		/**
+		 * @brief Replace the policies used for memory mapped from now on
+		 *
+		 * @note Memory that is already mapped keeps the policies it was mapped with
+		 */
+		static void configure(const config &settings) noexcept
+		{
+			auto& state = get_central_state();
+			state.huge_pages.store(settings.huge_pages, memory_order::relaxed);
+			state.huge_page_threshold.store(settings.huge_page_threshold, memory_order::relaxed);
+			state.populate.store(settings.populate, memory_order::relaxed);
+			state.large_cache_limit.store(settings.large_cache_limit, memory_order::relaxed);
+			state.large_cache_decay_ms.store(settings.large_cache_decay_ms, memory_order::relaxed);
+			state.sample_interval.store(settings.sample_interval, memory_order::relaxed);
+			state.pinned.store(settings.pinned, memory_order::relaxed);
+		}
+
+		/**
+		 * @brief The policies currently in effect
+		 */
+		static config configuration() noexcept
+		{
+			auto& state = get_central_state();
+			config result;
+			result.huge_pages = state.huge_pages.load(memory_order::relaxed);
+			result.huge_page_threshold = state.huge_page_threshold.load(memory_order::relaxed);
+			result.populate = state.populate.load(memory_order::relaxed);
+			result.large_cache_limit = state.large_cache_limit.load(memory_order::relaxed);
+			result.large_cache_decay_ms = state.large_cache_decay_ms.load(memory_order::relaxed);
+			result.sample_interval = state.sample_interval.load(memory_order::relaxed);
+			result.pinned = state.pinned.load(memory_order::relaxed);
+			return result;
+		}
+
+	private:
+		static constexpr size_t PAGE_SIZE = 4096;
+		static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024; /* default size of the hugetlb pool */
+
+		static constexpr size_t TINY_THRESHOLD = 128;
+		static constexpr size_t SMALL_THRESHOLD = 512;
+		static constexpr size_t LARGE_THRESHOLD = 1024 * 1024;
+
+		/* freed large blocks are bucketed four per doubling from 1 MiB on, like the size
+		 * classes; the last bucket also takes anything bigger */
+		static constexpr size_t LARGE_CACHE_BUCKETS = 4 * 16;
+		static constexpr size_t LARGE_CACHE_LIMIT = 64 * 1024 * 1024;
+		static constexpr uint32_t LARGE_CACHE_DECAY_MS = 1000;
+
+		/* a thread with sampling turned off looks again after allocating this much */
+		static constexpr int64_t SAMPLE_RECHECK_BYTES = 1024 * 1024;
+		static constexpr size_t MAX_SAMPLE_FRAMES = 32;
+		static constexpr size_t MIN_SAMPLE_SLOTS = 1024;
+
+		static constexpr size_t RESERVE_BATCH = 64; /* blocks reserve() takes per call to allocate_batch */
+
+		/* 8, 16, 24, 32, 48, then every 16 bytes up to 128, every 64 bytes up to 512 and
+		 * four classes per doubling up to 1 MiB; at most 25% of a block is ever wasted */
+		static constexpr size_t TINY_CLASSES = 10;
+		static constexpr size_t SMALL_CLASSES = 6;
+		static constexpr size_t SIZE_CLASSES = TINY_CLASSES + SMALL_CLASSES + 4 * 11;
+
+		static constexpr size_t SEGMENT_SHIFT = 22;
+		static constexpr size_t SEGMENT_SIZE = 1ULL << SEGMENT_SHIFT; /* 4 MiB */
+		static constexpr size_t SLICE_SHIFT = 16;
+		static constexpr size_t SLICE_SIZE = 1ULL << SLICE_SHIFT;     /* 64 KiB */
+		static constexpr size_t SLICES = SEGMENT_SIZE / SLICE_SIZE;   /* slice 0 holds the metadata */
+		static constexpr size_t MAX_SPAN_SLICES = 32;                 /* 2 MiB */
+		static constexpr size_t MIN_SPAN_BLOCKS = 8;
+
+		/* free slices kept committed before they are purged down to half this amount */
+		static constexpr size_t DIRTY_LIMIT = 4 * SEGMENT_SIZE;
+
+		/* a refill/drain moves roughly this many bytes worth of blocks; a thread cache keeps
+		 * at most two batches per class before it gives one back to the central heap */
+		static constexpr size_t BATCH_BYTES = 16 * 1024;
+		static constexpr size_t MIN_BATCH = 2;
+		static constexpr size_t MAX_BATCH = 64;
+
+		/* first word of every segment; catches pointers that never came from this heap */
+		static constexpr uint64_t SEGMENT_MAGIC = 0xDEADBEEF12345678;
+
+		/* a free block is nothing but the link to the next one */
+		struct FreeBlock
+		{
+			FreeBlock *next;
+		};
+
+		struct SizeClass
+		{
+			uint32_t size;   /* block size; blocks are packed without any padding */
+			uint32_t blocks; /* number of blocks per span */
+			uint32_t slices; /* number of slices per span */
+			uint32_t batch;  /* number of blocks moved between a thread cache and the central heap */
+		};
+
+		/* where other threads push the blocks they free into spans a thread cache owns; the
+		 * owner takes the whole stack at its next refill. Stacks are never unmapped, since a
+		 * late free may still push onto one after its thread exited, and are recycled for new
+		 * threads instead */
+		struct alignas(64) RemoteStack
+		{
+			atomic<FreeBlock *> head;
+			RemoteStack *next_free; /* next unused stack in the central pool */
+		};
+
+		/* a run of slices dedicated to one size class; lives in its segment's metadata. The
+		 * thread cache owning a span carves and recycles its blocks without any lock; a span
+		 * without an owner is only touched under the central lock */
+		struct Span
+		{
+			/* the only fields every free reads come first, so they share a cache line */
+			atomic<RemoteStack *> owner; /* remote stack of the owning thread, nullptr if none */
+		#if ACHERON_ALLOCATOR_SAMPLING
+			atomic<uint64_t> sampled; /* sample_bit of every sampled block; may hold stale bits */
+		#endif
+			uint8_t *start;          /* first block */
+			uint8_t *bump;           /* next never-carved block */
+			uint8_t *end;            /* one past the last block */
+			FreeBlock *free_list;    /* returned blocks not held by any thread cache */
+			Span *next;              /* next span in its owner's or the central partial list */
+			Span *prev;
+			atomic<uint32_t> used;   /* blocks handed out; atomic only so snapshots can read it */
+		#if ACHERON_ALLOCATOR_SAMPLING
+			uint32_t samples;        /* sampled blocks in the span; guarded by the sample lock */
+		#endif
+			uint8_t size_class;
+			bool partial;            /* linked into a partial list */
+		};
+
+		/* a large block reuses the first five fields; its data starts PAGE_SIZE in */
+		struct Segment
+		{
+			uint64_t magic;
+			size_t mapped;              /* size of the mapping for a large block, zero otherwise */
+			bool hugetlb;               /* large block backed by the hugetlb pool */
+			bool sampled;               /* large block recorded by the heap profiler */
+			uint64_t cached_at;         /* when a large block entered the large cache, in ms */
+			Segment *next;              /* next segment in the heap, or next block in a cache bucket */
+			uint64_t used_slices;       /* bit i set if slice i belongs to a span */
+			uint64_t dirty_slices;      /* bit i set if slice i is free but still committed */
+			uint8_t span_of[SLICES];    /* first slice of the span covering each slice */
+			Span spans[SLICES];         /* indexed by the span's first slice */
+		};
+
+		static_assert(sizeof(Segment) <= SLICE_SIZE, "segment metadata must fit in slice 0");
+
+	#if ACHERON_ALLOCATOR_SAMPLING
+		/* a live sampled block and where it was allocated from */
+		struct Sample
+		{
+			const void *block;  /* nullptr marks a free slot */
+			size_t bytes;       /* size the block was requested with */
+			size_t weight;      /* live bytes the sample stands for */
+			size_t depth;
+			void *frames[MAX_SAMPLE_FRAMES];
+		};
+	#endif
+
+		/* built at compile time; the hot paths only ever read it */
+		static constexpr auto size_classes = []
+		{
+			struct
+			{
+				SizeClass classes[SIZE_CLASSES];
+				uint8_t tiny_index[TINY_THRESHOLD / 8 + 1]; /* class of every 8-byte step */
+			} table = {};
+
+			constexpr auto class_size = [](const size_t index) -> size_t
+			{
+				constexpr size_t tiny[TINY_CLASSES] = { 8, 16, 24, 32, 48, 64, 80, 96, 112, 128 };
+				if (index < TINY_CLASSES)
+					return tiny[index];
+				if (index < TINY_CLASSES + SMALL_CLASSES)
+					return TINY_THRESHOLD + (index - TINY_CLASSES + 1) * 64;
+
+				const size_t step = index - TINY_CLASSES - SMALL_CLASSES;
+				const size_t base = SMALL_THRESHOLD << (step / 4);
+				return base + (step % 4 + 1) * (base / 4);
+			};
+
+			for (size_t i = 0; i < SIZE_CLASSES; ++i)
+			{
+				const size_t size = class_size(i);
+				const size_t batch = BATCH_BYTES / size;
+
+				/* smallest span that fits a handful of blocks, up to 2 MiB */
+				size_t slices = 1;
+				while (slices < MAX_SPAN_SLICES && slices * SLICE_SIZE / size < MIN_SPAN_BLOCKS)
+					++slices;
+
+				table.classes[i].size = static_cast<uint32_t>(size);
+				table.classes[i].blocks = static_cast<uint32_t>(slices * SLICE_SIZE / size);
+				table.classes[i].slices = static_cast<uint32_t>(slices);
+				table.classes[i].batch = static_cast<uint32_t>(batch < MIN_BATCH ? MIN_BATCH :
+				                                               batch > MAX_BATCH ? MAX_BATCH : batch);
+			}
+
+			for (size_t step = 0, i = 0; step <= TINY_THRESHOLD / 8; ++step)
+			{
+				while (class_size(i) < step * 8)
+					++i;
+				table.tiny_index[step] = static_cast<uint8_t>(i);
+			}
+			return table;
+		}();
+
+		static_assert(size_classes.classes[SIZE_CLASSES - 1].size == LARGE_THRESHOLD, "size classes must reach the large threshold");
+
+		static uint8_t get_size_class(const size_t size)
+		{
+			if (size <= TINY_THRESHOLD)
+				return size_classes.tiny_index[(size + 7) >> 3];
+
+			if (size <= SMALL_THRESHOLD)
+				return TINY_CLASSES - 3 + ((size + 63) >> 6); /* 64 bytes increments */
+
+			/* four classes between consecutive powers of two */
+			const size_t log2 = 63 - __builtin_clzll(size - 1);
+			const size_t quarter = ((size - 1) >> (log2 - 2)) & 3;
+			return TINY_CLASSES + SMALL_CLASSES + (log2 - 9) * 4 + quarter;
+		}
+
+		/* whether a block of aligned_size bytes comes from a span: spans start on a slice
+		 * boundary, so their blocks are aligned to the largest power of two dividing the size */
+		static bool fits_size_class(const size_t size, const size_t align)
+		{
+			return size < LARGE_THRESHOLD ? align <= SLICE_SIZE : align <= PAGE_SIZE;
+		}
+
+		/* size allocate_aligned requests: the smallest size class that is a multiple of `align`,
+		 * or the size rounded up to it past the size classes; zero if unsupported */
+		static size_t aligned_size(const size_t bytes, const size_t align)
+		{
+			if (!std::has_single_bit(align) || align > MAX_ALIGNMENT)
+				return 0;
+
+			const size_t size = (bytes + align - 1) & ~(align - 1);
+			if (size < bytes)
+				return 0; /* overflow */
+			if (size >= LARGE_THRESHOLD || align > SLICE_SIZE)
+				return size;
+
+			uint8_t size_class = get_size_class(size);
+			while (size_classes.classes[size_class].size & (align - 1))
+				++size_class;
+			return size_classes.classes[size_class].size;
+		}
+
+		struct ThreadCache;
+
+		struct CentralState
+		{
+			Span *partial[SIZE_CLASSES] = {}; /* spans without an owner that have free or uncarved blocks */
+			Segment *segments = nullptr;
+			size_t dirty_bytes = 0;           /* free slices not yet given back */
+			RemoteStack *free_remotes = nullptr;
+			spin_lock lock; /* guards the segments, spans without an owner and span ownership */
+
+		#if ACHERON_ALLOCATOR_STATS
+			ThreadCache *caches = nullptr;          /* every live thread cache, for snapshots */
+			uint64_t allocations[SIZE_CLASSES] = {}; /* from exited threads */
+			uint64_t frees[SIZE_CLASSES] = {};
+			atomic<uint64_t> large_allocations;
+			atomic<uint64_t> large_frees;
+			atomic<uint64_t> large_bytes;
+		#endif
+
+			/* see heap::config */
+			atomic<huge_page_policy> huge_pages { huge_page_policy::none };
+			atomic<size_t> huge_page_threshold { HUGE_PAGE_SIZE };
+			atomic<bool> populate { false };
+			atomic<size_t> large_cache_limit { LARGE_CACHE_LIMIT };
+			atomic<uint32_t> large_cache_decay_ms { LARGE_CACHE_DECAY_MS };
+			atomic<size_t> sample_interval { 0 };
+			atomic<bool> pinned { false };
+
+			Segment *large_cache[LARGE_CACHE_BUCKETS] = {}; /* most recently freed first */
+			size_t large_cached_bytes = 0;
+			spin_lock large_lock; /* guards the large cache; never held across a system call */
+
+		#if ACHERON_ALLOCATOR_SAMPLING
+			Sample *samples = nullptr; /* open addressing on the block address, linear probing */
+			size_t sample_slots = 0;
+			size_t sample_count = 0;
+			spin_lock sample_lock; /* guards the sample table and the span sample counts */
+		#endif
+		};
+
+		static CentralState &get_central_state()
+		{
+			static CentralState state;
+			return state;
+		}
+
+		/* per-thread front-end; plain data so it is constant-initialized and never needs a
+		 * TLS guard on the hot path */
+		struct ThreadCache
+		{
+			enum : uint8_t { UNINITIALIZED, ACTIVE, EXITED };
+
+			FreeBlock *free_lists[SIZE_CLASSES];
+			uint32_t counts[SIZE_CLASSES];
+			Span *partial[SIZE_CLASSES]; /* owned spans with free or uncarved blocks */
+			RemoteStack *remote;
+			uint8_t state;
+
+		#if ACHERON_ALLOCATOR_SAMPLING
+			int64_t sample_countdown; /* bytes left until the next sampled allocation */
+			uint64_t sample_seed;     /* zero until the first countdown was drawn */
+		#endif
+
+		#if ACHERON_ALLOCATOR_STATS
+			/* only ever written by the owning thread; snapshots read them without stopping it */
+			atomic<uint64_t> allocations[SIZE_CLASSES];
+			atomic<uint64_t> frees[SIZE_CLASSES];
+			ThreadCache *next;
+			ThreadCache *prev;
+		#endif
+		};
+
+		/* flushes the owning thread's cache and hands its spans back to the central heap when
+		 * the thread exits */
+		struct ThreadCacheReaper
+		{
+			~ThreadCacheReaper()
+			{
+				ThreadCache &cache = thread_cache;
+				collect_remote_frees(cache);
+				for (size_t i = 0; i < SIZE_CLASSES; ++i)
+					drain_thread_cache(static_cast<uint8_t>(i), cache.counts[i]);
+				cache.state = ThreadCache::EXITED;
+
+				auto& state = get_central_state();
+				{
+					std::lock_guard guard(state.lock);
+					abandon_spans(cache);
+				}
+
+				/* whatever was pushed meanwhile now goes to the central heap; anything later is
+				 * taken care of by the next thread using the stack */
+				collect_remote_frees(cache);
+
+				std::lock_guard guard(state.lock);
+				cache.remote->next_free = state.free_remotes;
+				state.free_remotes = cache.remote;
+
+			#if ACHERON_ALLOCATOR_STATS
+				/* fold the counters into the central ones so they outlive the thread */
+				for (size_t i = 0; i < SIZE_CLASSES; ++i)
+				{
+					state.allocations[i] += cache.allocations[i].load(memory_order::relaxed);
+					state.frees[i] += cache.frees[i].load(memory_order::relaxed);
+				}
+				if (cache.prev)
+					cache.prev->next = cache.next;
+				else
+					state.caches = cache.next;
+				if (cache.next)
+					cache.next->prev = cache.prev;
+			#endif
+			}
+		};
+
+		static inline thread_local ThreadCache thread_cache = {};
+
+		/* registers the reaper and hands out a remote stack on the thread's first slow-path
+		 * call; returns false once the thread has started tearing down its thread-locals */
+		static bool activate_thread_cache()
+		{
+			ThreadCache &cache = thread_cache;
+			if (cache.state == ThreadCache::EXITED)
+				return false;
+
+			auto& state = get_central_state();
+			std::lock_guard guard(state.lock);
+			if (!(cache.remote = acquire_remote_stack()))
+				return false;
+
+			static thread_local ThreadCacheReaper reaper;
+			(void) reaper;
+			cache.state = ThreadCache::ACTIVE;
+
+		#if ACHERON_ALLOCATOR_STATS
+			cache.prev = nullptr;
+			cache.next = state.caches;
+			if (cache.next)
+				cache.next->prev = &cache;
+			state.caches = &cache;
+		#endif
+			return true;
+		}
+
+		/* owner-only increment; a plain load and store, no read-modify-write */
+		static void count(atomic<uint64_t> &counter, const uint64_t n = 1)
+		{
+			counter.store(counter.load(memory_order::relaxed) + n, memory_order::relaxed);
+		}
+
+		/* owner-only update of a span's block count; returns the new count */
+		static uint32_t adjust_used(Span *span, const int32_t delta)
+		{
+			const uint32_t used = span->used.load(memory_order::relaxed) + delta;
+			span->used.store(used, memory_order::relaxed);
+			return used;
+		}
+
+		/* hands out a remote stack for a new thread cache; expects the central lock to be held */
+		static RemoteStack *acquire_remote_stack()
+		{
+			auto& state = get_central_state();
+			if (!state.free_remotes)
+			{
+				void *mem = mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (mem == MAP_FAILED)
+					return nullptr;
+
+				auto *stacks = static_cast<RemoteStack *>(mem);
+				for (size_t i = 0; i < PAGE_SIZE / sizeof(RemoteStack); ++i)
+				{
+					stacks[i].next_free = state.free_remotes;
+					state.free_remotes = &stacks[i];
+				}
+			}
+
+			RemoteStack *stack = state.free_remotes;
+			state.free_remotes = stack->next_free;
+			return stack;
+		}
+
+		static Segment *segment_of(const void *p)
+		{
+			return reinterpret_cast<Segment *>(reinterpret_cast<uintptr_t>(p) & ~(SEGMENT_SIZE - 1));
+		}
+
+		static Span *span_of(const void *p)
+		{
+			Segment *segment = segment_of(p);
+			const size_t slice = (reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(segment)) >> SLICE_SHIFT;
+			return &segment->spans[segment->span_of[slice]];
+		}
+
+		/* maps `size` bytes aligned to a segment boundary by over-mapping and trimming the excess;
+		 * `granule` is the alignment the kernel already guarantees for the given flags */
+		static uint8_t *reserve_aligned(const size_t size, const int flags = 0, const size_t granule = PAGE_SIZE)
+		{
+			const size_t reserved = size + SEGMENT_SIZE - granule;
+			void *mem = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+			if (mem == MAP_FAILED)
+				return nullptr;
+
+			auto *raw = static_cast<uint8_t *>(mem);
+			const uintptr_t base = (reinterpret_cast<uintptr_t>(raw) + SEGMENT_SIZE - 1) & ~(SEGMENT_SIZE - 1);
+			auto *aligned = reinterpret_cast<uint8_t *>(base);
+			if (aligned != raw)
+				munmap(raw, aligned - raw);
+			if (const size_t tail = raw + reserved - (aligned + size))
+				munmap(aligned + size, tail);
+			return aligned;
+		}
+
+		/* fresh anonymous pages are zero, which is a valid empty segment */
+		static Segment *map_aligned(const size_t size)
+		{
+			auto *segment = reinterpret_cast<Segment *>(reserve_aligned(size));
+			if (segment)
+			{
+				advise_huge_pages(segment, size);
+				segment->magic = SEGMENT_MAGIC;
+			}
+			return segment;
+		}
+
+		/* opts a fresh mapping into transparent huge pages when the policy asks for it; the
+		 * hugetlb policy gets the same treatment for everything the pool does not back */
+		static void advise_huge_pages(void *mem, const size_t size)
+		{
+		#ifdef MADV_HUGEPAGE
+			auto& state = get_central_state();
+			if (state.huge_pages.load(memory_order::relaxed) != huge_page_policy::none &&
+			    size >= state.huge_page_threshold.load(memory_order::relaxed))
+				madvise(mem, size, MADV_HUGEPAGE);
+		#else
+			(void) mem;
+			(void) size;
+		#endif
+		}
+
+		/* faults a range in up front, so first touches do not stall */
+		static void populate(uint8_t *mem, const size_t size)
+		{
+		#ifdef MADV_POPULATE_WRITE
+			if (madvise(mem, size, MADV_POPULATE_WRITE) == 0)
+				return;
+		#endif
+			/* older kernels; the pages are still zero, so writing one changes nothing */
+			for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+				*reinterpret_cast<volatile uint8_t *>(mem + offset) = 0;
+		}
+
+		/* faults in the pages under memory the caller owns; unlike populate, other blocks may
+		 * share those pages, so their contents are left alone */
+		static void prefault(uint8_t *mem, const size_t size)
+		{
+		#ifdef MADV_POPULATE_WRITE
+			const uintptr_t first = reinterpret_cast<uintptr_t>(mem) & ~(PAGE_SIZE - 1);
+			const uintptr_t last = (reinterpret_cast<uintptr_t>(mem) + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+			if (madvise(reinterpret_cast<void *>(first), last - first, MADV_POPULATE_WRITE) == 0)
+				return;
+		#endif
+			/* one write per page, always inside the caller's memory */
+			for (uint8_t *p = mem; p < mem + size;
+			     p = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(p) + PAGE_SIZE) & ~(PAGE_SIZE - 1)))
+				*reinterpret_cast<volatile uint8_t *>(p) = 0;
+		}
+
+		static uint64_t slice_mask(const size_t first, const size_t count)
+		{
+			return (count == 64 ? ~0ULL : (1ULL << count) - 1) << first;
+		}
+
+		static size_t find_free_slices(const Segment *segment, const size_t count)
+		{
+			for (size_t first = 1; first + count <= SLICES; ++first)
+			{
+				if ((segment->used_slices & slice_mask(first, count)) == 0)
+					return first;
+			}
+			return 0;
+		}
+
+		/* carves a new span for a size class; expects the central lock to be held */
+		static Span *allocate_span(uint8_t size_class)
+		{
+			auto& state = get_central_state();
+			const SizeClass &sc = size_classes.classes[size_class];
+
+			Segment *segment = state.segments;
+			size_t first = 0;
+			for (; segment; segment = segment->next)
+			{
+				if ((first = find_free_slices(segment, sc.slices)) != 0)
+					break;
+			}
+
+			if (!segment)
+			{
+				segment = map_aligned(SEGMENT_SIZE);
+				if (!segment)
+					return nullptr;
+				segment->used_slices = 1; /* slice 0 holds this metadata */
+				segment->next = state.segments;
+				state.segments = segment;
+				first = 1;
+			}
+
+			/* reusing still-committed slices is what makes keeping them worthwhile */
+			const uint64_t mask = slice_mask(first, sc.slices);
+			state.dirty_bytes -= __builtin_popcountll(segment->dirty_slices & mask) * SLICE_SIZE;
+			segment->dirty_slices &= ~mask;
+			segment->used_slices |= mask;
+			for (size_t i = first; i < first + sc.slices; ++i)
+				segment->span_of[i] = static_cast<uint8_t>(first);
+
+			Span *span = &segment->spans[first];
+			span->start = reinterpret_cast<uint8_t *>(segment) + first * SLICE_SIZE;
+			span->bump = span->start;
+			span->end = span->start + static_cast<size_t>(sc.blocks) * sc.size;
+			span->free_list = nullptr;
+			span->owner.store(nullptr, memory_order::relaxed);
+			span->used.store(0, memory_order::relaxed);
+		#if ACHERON_ALLOCATOR_SAMPLING
+			span->sampled.store(0, memory_order::relaxed);
+			span->samples = 0;
+		#endif
+			span->size_class = size_class;
+			span->partial = false;
+			return span;
+		}
+
+		static void link_partial(Span *&head, Span *span)
+		{
+			span->prev = nullptr;
+			span->next = head;
+			if (span->next)
+				span->next->prev = span;
+			head = span;
+			span->partial = true;
+		}
+
+		static void unlink_partial(Span *&head, Span *span)
+		{
+			if (span->prev)
+				span->prev->next = span->next;
+			else
+				head = span->next;
+			if (span->next)
+				span->next->prev = span->prev;
+			span->next = span->prev = nullptr;
+			span->partial = false;
+		}
+
+		/* pops a recycled block or carves a fresh one; expects the span to be owned by the
+		 * calling thread or the central lock to be held */
+		static FreeBlock *take_block(Span *span)
+		{
+			FreeBlock *block = span->free_list;
+			if (block)
+			{
+				span->free_list = block->next;
+			}
+			else if (span->bump < span->end)
+			{
+				block = reinterpret_cast<FreeBlock *>(span->bump);
+				span->bump += size_classes.classes[span->size_class].size;
+			}
+			else
+			{
+				return nullptr;
+			}
+
+			adjust_used(span, 1);
+			return block;
+		}
+
+		/* gives a block back to its span; expects the span to have no owner and the central
+		 * lock to be held */
+		static void return_block(FreeBlock *block)
+		{
+			Span *span = span_of(block);
+			block->next = span->free_list;
+			span->free_list = block;
+			if (adjust_used(span, -1) == 0)
+			{
+				release_span(span);
+				return;
+			}
+			if (!span->partial)
+				link_partial(get_central_state().partial[span->size_class], span);
+		}
+
+		/* gives a block back to a span the calling thread owns; only takes the central lock
+		 * when the span empties and is given up */
+		static void return_owned_block(ThreadCache &cache, FreeBlock *block)
+		{
+			Span *span = span_of(block);
+			block->next = span->free_list;
+			span->free_list = block;
+			if (adjust_used(span, -1) == 0)
+			{
+				if (span->partial)
+					unlink_partial(cache.partial[span->size_class], span);
+
+				std::lock_guard guard(get_central_state().lock);
+				span->owner.store(nullptr, memory_order::relaxed);
+				release_span(span);
+				return;
+			}
+			if (!span->partial)
+				link_partial(cache.partial[span->size_class], span);
+		}
+
+		/* hands a span's slices back to its segment; expects the span to have no owner and
+		 * the central lock to be held */
+		static void release_span(Span *span)
+		{
+			auto& state = get_central_state();
+			if (span->partial)
+				unlink_partial(state.partial[span->size_class], span);
+
+			Segment *segment = segment_of(span->start);
+			const uint64_t mask = slice_mask(span - segment->spans, size_classes.classes[span->size_class].slices);
+			segment->used_slices &= ~mask;
+			segment->dirty_slices |= mask;
+			state.dirty_bytes += __builtin_popcountll(mask) * SLICE_SIZE;
+
+			if (ACHERON_UNLIKELY(state.dirty_bytes > DIRTY_LIMIT) && !state.pinned.load(memory_order::relaxed))
+				purge(DIRTY_LIMIT / 2, false);
+		}
+
+		/* decommits free slices until at most `keep_bytes` stay committed and unmaps segments
+		 * left without spans; expects the central lock to be held */
+		static size_t purge(const size_t keep_bytes, const bool unmap_clean)
+		{
+			auto& state = get_central_state();
+			size_t released = 0;
+
+			Segment **link = &state.segments;
+			while (Segment *segment = *link)
+			{
+				const size_t dirty = __builtin_popcountll(segment->dirty_slices) * SLICE_SIZE;
+				if (segment->used_slices == 1 && (state.dirty_bytes > keep_bytes || (unmap_clean && !dirty)))
+				{
+					*link = segment->next;
+					state.dirty_bytes -= dirty;
+					released += dirty;
+					munmap(segment, SEGMENT_SIZE);
+					continue;
+				}
+
+				for (size_t i = 1; i < SLICES && state.dirty_bytes > keep_bytes;)
+				{
+					if (!(segment->dirty_slices & (1ULL << i)))
+					{
+						++i;
+						continue;
+					}
+
+					/* one call per run of adjacent free slices */
+					size_t run = 1;
+					while (i + run < SLICES && (segment->dirty_slices & (1ULL << (i + run))))
+						++run;
+
+					madvise(reinterpret_cast<uint8_t *>(segment) + i * SLICE_SIZE, run * SLICE_SIZE, MADV_DONTNEED);
+					segment->dirty_slices &= ~slice_mask(i, run);
+					state.dirty_bytes -= run * SLICE_SIZE;
+					released += run * SLICE_SIZE;
+					i += run;
+				}
+
+				link = &segment->next;
+			}
+
+			return released;
+		}
+
+		static void *allocate_from_size_class(uint8_t size_class)
+		{
+			ThreadCache &cache = thread_cache;
+			FreeBlock *block = cache.free_lists[size_class];
+			if (ACHERON_LIKELY(block != nullptr))
+			{
+				cache.free_lists[size_class] = block->next;
+				--cache.counts[size_class];
+			#if ACHERON_ALLOCATOR_STATS
+				count(cache.allocations[size_class]);
+			#endif
+				return block;
+			}
+
+			return refill_and_allocate(size_class);
+		}
+
+		static void free_to_size_class(FreeBlock *block, uint8_t size_class)
+		{
+			Span *span = span_of(block);
+		#if ACHERON_ALLOCATOR_SAMPLING
+			if (ACHERON_UNLIKELY(span->sampled.load(memory_order::relaxed) & sample_bit(block)))
+				forget_sample(block);
+		#endif
+
+			ThreadCache &cache = thread_cache;
+			if (ACHERON_UNLIKELY(cache.state != ThreadCache::ACTIVE || span->owner.load(memory_order::relaxed) != cache.remote))
+			{
+				free_unowned(block, size_class);
+				return;
+			}
+
+		#if ACHERON_ALLOCATOR_STATS
+			count(cache.frees[size_class]);
+		#endif
+			block->next = cache.free_lists[size_class];
+			cache.free_lists[size_class] = block;
+
+			const size_t batch = size_classes.classes[size_class].batch;
+			if (ACHERON_UNLIKELY(++cache.counts[size_class] > 2 * batch))
+				drain_thread_cache(size_class, batch);
+		}
+
+		/* frees a block the thread cannot keep: one of a span it does not own, or any block
+		 * once its cache is gone; kept out of line so the common path stays small */
+		ACHERON_NOINLINE static void free_unowned(FreeBlock *block, uint8_t size_class)
+		{
+		#if !ACHERON_ALLOCATOR_STATS
+			(void) size_class;
+		#endif
+			ThreadCache &cache = thread_cache;
+			if (cache.state != ThreadCache::ACTIVE && !activate_thread_cache())
+			{
+				/* the thread is exiting and its cache is gone */
+			#if ACHERON_ALLOCATOR_STATS
+				auto& state = get_central_state();
+				std::lock_guard guard(state.lock);
+				++state.frees[size_class];
+			#endif
+			}
+			else
+			{
+			#if ACHERON_ALLOCATOR_STATS
+				count(cache.frees[size_class]);
+			#endif
+			}
+
+			/* a freshly activated cache owns no spans yet, so the block is foreign either way */
+			free_foreign(block, span_of(block)->owner.load(memory_order::relaxed));
+		}
+
+		/* returns a block of a span the calling thread does not own: a single CAS onto the
+		 * owner's remote stack, or the central lock if the span has no owner */
+		static void free_foreign(FreeBlock *block, RemoteStack *owner)
+		{
+			if (!owner)
+			{
+				std::lock_guard guard(get_central_state().lock);
+				/* ownership only changes under the lock; the span may have been adopted since */
+				owner = span_of(block)->owner.load(memory_order::relaxed);
+				if (!owner)
+				{
+					return_block(block);
+					return;
+				}
+			}
+
+			FreeBlock *head = owner->head.load(memory_order::relaxed);
+			do
+				block->next = head;
+			while (!owner->head.compare_exchange_weak(head, block, memory_order::release, memory_order::relaxed));
+		}
+
+		/* takes back everything other threads freed into the thread's spans since the last
+		 * refill; blocks of spans it has given up meanwhile are passed on */
+		static void collect_remote_frees(ThreadCache &cache)
+		{
+			if (!cache.remote->head.load(memory_order::relaxed))
+				return;
+
+			FreeBlock *block = cache.remote->head.exchange(nullptr, memory_order::acquire);
+			while (block)
+			{
+				FreeBlock *next = block->next;
+				RemoteStack *owner = span_of(block)->owner.load(memory_order::relaxed);
+				if (owner == cache.remote)
+					return_owned_block(cache, block);
+				else
+					free_foreign(block, owner);
+				block = next;
+			}
+		}
+
+		ACHERON_NOINLINE static void *refill_and_allocate(uint8_t size_class)
+		{
+			ThreadCache &cache = thread_cache;
+			if (cache.state != ThreadCache::ACTIVE && !activate_thread_cache())
+				return allocate_unowned(size_class);
+
+			collect_remote_frees(cache);
+
+			/* only grow the heap if nothing at all could be recycled */
+			FreeBlock *first = nullptr;
+			const size_t taken = take_blocks(cache, size_class, size_classes.classes[size_class].batch, 1, first);
+			if (!first)
+				return nullptr; /* failed */
+
+		#if ACHERON_ALLOCATOR_STATS
+			count(cache.allocations[size_class]);
+		#endif
+
+			/* hand out the first block and keep the rest */
+			if (first->next)
+			{
+				cache.free_lists[size_class] = first->next;
+				cache.counts[size_class] += taken - 1;
+			}
+
+			return first;
+		}
+
+		/* chains up to `wanted` blocks of a class from the thread's own spans onto `first`,
+		 * adopting more spans only while fewer than `needed` could be recycled */
+		static size_t take_blocks(ThreadCache &cache, uint8_t size_class, size_t wanted, size_t needed, FreeBlock *&first)
+		{
+			size_t taken = 0;
+			while (taken < wanted)
+			{
+				Span *span = cache.partial[size_class];
+				if (!span && (taken >= needed || !(span = adopt_span(cache, size_class))))
+					break;
+
+				while (taken < wanted)
+				{
+					FreeBlock *block = take_block(span);
+					if (!block)
+						break;
+					block->next = first;
+					first = block;
+					++taken;
+				}
+
+				if (!span->free_list && span->bump >= span->end)
+					unlink_partial(cache.partial[size_class], span);
+			}
+
+			return taken;
+		}
+
+		/* makes the thread the owner of a span of the class: one given up by an exited thread
+		 * if there is any, a new one otherwise */
+		static Span *adopt_span(ThreadCache &cache, uint8_t size_class)
+		{
+			auto& state = get_central_state();
+			Span *span;
+			{
+				std::lock_guard guard(state.lock);
+				if ((span = state.partial[size_class]))
+					unlink_partial(state.partial[size_class], span);
+				else if (!(span = allocate_span(size_class)))
+					return nullptr;
+				span->owner.store(cache.remote, memory_order::relaxed);
+			}
+
+			link_partial(cache.partial[size_class], span);
+			return span;
+		}
+
+		/* serves a thread whose cache is gone straight from the spans without an owner */
+		static void *allocate_unowned(uint8_t size_class)
+		{
+			auto& state = get_central_state();
+			std::lock_guard guard(state.lock);
+			Span *span = state.partial[size_class];
+			if (!span)
+			{
+				if (!(span = allocate_span(size_class)))
+					return nullptr;
+				link_partial(state.partial[size_class], span);
+			}
+
+			FreeBlock *block = take_block(span);
+			if (!span->free_list && span->bump >= span->end)
+				unlink_partial(state.partial[size_class], span);
+		#if ACHERON_ALLOCATOR_STATS
+			++state.allocations[size_class];
+		#endif
+			return block;
+		}
+
+		/* moves the first `count` blocks of the thread's list back to their spans */
+		static void drain_thread_cache(uint8_t size_class, size_t count)
+		{
+			ThreadCache &cache = thread_cache;
+			for (; count && cache.free_lists[size_class]; --count)
+			{
+				FreeBlock *block = cache.free_lists[size_class];
+				cache.free_lists[size_class] = block->next;
+				--cache.counts[size_class];
+				return_owned_block(cache, block);
+			}
+		}
+
+		/* gives every span the thread owns back to the central heap, where the next thread
+		 * short of blocks adopts it; expects the central lock to be held */
+		static void abandon_spans(ThreadCache &cache)
+		{
+			auto& state = get_central_state();
+			for (Segment *segment = state.segments; segment; segment = segment->next)
+			{
+				for (size_t i = 1; i < SLICES; ++i)
+				{
+					if (!(segment->used_slices & (1ULL << i)) || segment->span_of[i] != i)
+						continue;
+
+					Span *span = &segment->spans[i];
+					if (span->owner.load(memory_order::relaxed) != cache.remote)
+						continue;
+
+					span->owner.store(nullptr, memory_order::relaxed);
+					span->partial = false;
+					if (span->used.load(memory_order::relaxed) == 0)
+						release_span(span);
+					else if (span->free_list || span->bump < span->end)
+						link_partial(state.partial[span->size_class], span);
+				}
+			}
+
+			for (size_t i = 0; i < SIZE_CLASSES; ++i)
+				cache.partial[i] = nullptr;
+		}
+
+		static size_t large_mapping(const size_t size)
+		{
+			return (PAGE_SIZE + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		}
+
+		/* large blocks get a segment-aligned mapping of their own, so the unsized deallocate
+		 * tells them apart from span blocks the same way, by masking the address */
+		static void *allocate_large(size_t size)
+		{
+			const size_t mapped = large_mapping(size);
+
+			Segment *segment = take_cached_large(mapped);
+			if (!segment)
+				segment = map_large(mapped);
+			if (!segment)
+				return nullptr;
+
+		#if ACHERON_ALLOCATOR_STATS
+			auto& state = get_central_state();
+			state.large_allocations.fetch_add(1, memory_order::relaxed);
+			state.large_bytes.fetch_add(segment->mapped, memory_order::relaxed);
+		#endif
+			return reinterpret_cast<uint8_t *>(segment) + PAGE_SIZE;
+		}
+
+		static Segment *map_large(size_t mapped)
+		{
+			auto& state = get_central_state();
+			Segment *segment = nullptr;
+
+		#ifdef MAP_HUGETLB
+			/* pool pages are never split, so the block takes whole huge pages */
+			if (state.huge_pages.load(memory_order::relaxed) == huge_page_policy::hugetlb &&
+			    mapped >= state.huge_page_threshold.load(memory_order::relaxed))
+			{
+				const size_t huge = (mapped + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+				segment = reinterpret_cast<Segment *>(reserve_aligned(huge, MAP_HUGETLB, HUGE_PAGE_SIZE));
+				if (segment)
+				{
+					mapped = huge;
+					segment->magic = SEGMENT_MAGIC;
+					segment->hugetlb = true;
+				}
+			}
+		#endif
+
+			/* a missing or exhausted pool falls back to regular mappings */
+			if (!segment)
+				segment = map_aligned(mapped);
+			if (!segment)
+				return nullptr;
+
+			segment->mapped = mapped;
+			if (state.populate.load(memory_order::relaxed))
+				populate(reinterpret_cast<uint8_t *>(segment) + PAGE_SIZE, mapped - PAGE_SIZE);
+			return segment;
+		}
+
+		static void free_large(Segment *segment)
+		{
+		#if ACHERON_ALLOCATOR_SAMPLING
+			if (ACHERON_UNLIKELY(segment->sampled))
+				forget_sample(reinterpret_cast<uint8_t *>(segment) + PAGE_SIZE);
+		#endif
+		#if ACHERON_ALLOCATOR_STATS
+			auto& state = get_central_state();
+			state.large_frees.fetch_add(1, memory_order::relaxed);
+			state.large_bytes.fetch_sub(segment->mapped, memory_order::relaxed);
+		#endif
+			if (!cache_large(segment))
+				munmap(segment, segment->mapped);
+		}
+
+		static uint64_t milliseconds()
+		{
+			using namespace std::chrono;
+			return duration_cast<std::chrono::milliseconds>(steady_clock::now().time_since_epoch()).count();
+		}
+
+		/* a bucket only holds blocks at least as big as its lower bound */
+		static size_t large_bucket(const size_t mapped)
+		{
+			const size_t log2 = 63 - __builtin_clzll(mapped);
+			const size_t bucket = (log2 - 20) * 4 + ((mapped >> (log2 - 2)) & 3);
+			return bucket < LARGE_CACHE_BUCKETS ? bucket : LARGE_CACHE_BUCKETS - 1;
+		}
+
+		/* keeps a freed large block for reuse; false if it has to be unmapped right away */
+		static bool cache_large(Segment *segment)
+		{
+			auto& state = get_central_state();
+			const size_t limit = state.large_cache_limit.load(memory_order::relaxed);
+			if (segment->mapped > limit)
+				return false;
+
+			Segment *expired;
+			{
+				/* the clock is read under the lock, so timestamps never go backwards in the cache */
+				std::lock_guard guard(state.large_lock);
+				const uint64_t now = milliseconds();
+				Segment *&bucket = state.large_cache[large_bucket(segment->mapped)];
+				segment->cached_at = now;
+				segment->next = bucket;
+				bucket = segment;
+				state.large_cached_bytes += segment->mapped;
+				expired = expire_large(now, limit);
+			}
+			unmap_large(expired);
+			return true;
+		}
+
+		/* reuses a cached block of at least `mapped` bytes; only the block's bucket and the
+		 * next one are searched, so at most half of the reused block goes unneeded */
+		static Segment *take_cached_large(const size_t mapped)
+		{
+			auto& state = get_central_state();
+			const size_t first = large_bucket(mapped);
+			Segment *found = nullptr;
+			Segment *expired;
+			{
+				std::lock_guard guard(state.large_lock);
+				if (state.large_cached_bytes == 0)
+					return nullptr;
+
+				expired = expire_large(milliseconds(), state.large_cache_limit.load(memory_order::relaxed));
+				for (size_t i = first; !found && i < first + 2 && i < LARGE_CACHE_BUCKETS; ++i)
+				{
+					for (Segment **link = &state.large_cache[i]; *link; link = &(*link)->next)
+					{
+						if ((*link)->mapped >= mapped)
+						{
+							found = *link;
+							*link = found->next;
+							state.large_cached_bytes -= found->mapped;
+							break;
+						}
+					}
+				}
+			}
+			unmap_large(expired);
+			return found;
+		}
+
+		/* unlinks the blocks cached for longer than the decay time, then the oldest ones until
+		 * at most `limit` bytes stay cached; expects the large lock to be held */
+		static Segment *expire_large(const uint64_t now, const size_t limit)
+		{
+			auto& state = get_central_state();
+			const uint64_t decay = state.pinned.load(memory_order::relaxed) ? std::numeric_limits<uint64_t>::max() : state.large_cache_decay_ms.load(memory_order::relaxed);
+			Segment *expired = nullptr;
+
+			const auto unlink = [&](Segment **link)
+			{
+				Segment *segment = *link;
+				*link = segment->next;
+				state.large_cached_bytes -= segment->mapped;
+				segment->next = expired;
+				expired = segment;
+			};
+
+			for (Segment *&bucket: state.large_cache)
+			{
+				for (Segment **link = &bucket; *link;)
+				{
+					if (now - (*link)->cached_at >= decay)
+						unlink(link);
+					else
+						link = &(*link)->next;
+				}
+			}
+
+			while (state.large_cached_bytes > limit)
+			{
+				Segment **oldest = nullptr;
+				for (Segment *&bucket: state.large_cache)
+				{
+					for (Segment **link = &bucket; *link; link = &(*link)->next)
+					{
+						if (!oldest || (*link)->cached_at < (*oldest)->cached_at)
+							oldest = link;
+					}
+				}
+				unlink(oldest);
+			}
+			return expired;
+		}
+
+		static void unmap_large(Segment *segment)
+		{
+			while (segment)
+			{
+				Segment *next = segment->next;
+				munmap(segment, segment->mapped);
+				segment = next;
+			}
+		}
+
+		static void resize_large(Segment *segment, const size_t old_mapped, const size_t new_mapped)
+		{
+			segment->mapped = new_mapped;
+		#if ACHERON_ALLOCATOR_STATS
+			get_central_state().large_bytes.fetch_add(new_mapped - old_mapped, memory_order::relaxed);
+		#else
+			(void) old_mapped;
+		#endif
+		}
+
+		/* a grown block may have crossed the huge page threshold, and its new pages are not
+		 * populated yet */
+		static void prepare_growth(Segment *segment, const size_t old_mapped, const size_t new_mapped)
+		{
+			advise_huge_pages(segment, new_mapped);
+			if (get_central_state().populate.load(memory_order::relaxed))
+				populate(reinterpret_cast<uint8_t *>(segment) + old_mapped, new_mapped - old_mapped);
+		}
+
+	#ifdef MREMAP_MAYMOVE
+		/* moves the pages of a large block to a fresh segment-aligned range without copying */
+		static void *move_large(void *p, const size_t new_bytes)
+		{
+			auto *segment = reinterpret_cast<Segment *>(static_cast<uint8_t *>(p) - PAGE_SIZE);
+			if (segment->hugetlb)
+				return nullptr;
+
+			const size_t old_mapped = segment->mapped;
+			const size_t new_mapped = large_mapping(new_bytes);
+
+			uint8_t *target = reserve_aligned(new_mapped);
+			if (!target)
+				return nullptr;
+
+			void *moved = mremap(segment, old_mapped, new_mapped, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+			if (moved == MAP_FAILED)
+			{
+				munmap(target, new_mapped);
+				return nullptr;
+			}
+
+			resize_large(static_cast<Segment *>(moved), old_mapped, new_mapped);
+			if (new_mapped > old_mapped)
+				prepare_growth(static_cast<Segment *>(moved), old_mapped, new_mapped);
+			return static_cast<uint8_t *>(moved) + PAGE_SIZE;
+		}
+	#endif
+
+	#if ACHERON_ALLOCATOR_SAMPLING
+		/* the bit a block sets in its span's sample filter */
+		static uint64_t sample_bit(const void *block)
+		{
+			return 1ULL << ((reinterpret_cast<uintptr_t>(block) * 0x9E3779B97F4A7C15ULL) >> 58);
+		}
+
+		/* draws the distance to the thread's next sample from an exponential distribution,
+		 * so every byte is equally likely to be sampled; returns the interval the current
+		 * allocation is sampled at, zero if it is not to be recorded */
+		static size_t next_sample(ThreadCache &cache)
+		{
+			const size_t interval = get_central_state().sample_interval.load(memory_order::relaxed);
+			const bool first = cache.sample_seed == 0;
+			if (first)
+				cache.sample_seed = reinterpret_cast<uintptr_t>(&cache) ^ 0x9E3779B97F4A7C15ULL;
+			if (!interval)
+			{
+				cache.sample_countdown = SAMPLE_RECHECK_BYTES;
+				return 0;
+			}
+
+			/* xorshift64* */
+			uint64_t x = cache.sample_seed;
+			x ^= x >> 12;
+			x ^= x << 25;
+			x ^= x >> 27;
+			cache.sample_seed = x;
+			const double uniform = static_cast<double>(((x * 0x2545F4914F6CDD1DULL) >> 11) + 1) * 0x1p-53;
+			cache.sample_countdown = static_cast<int64_t>(-std::log(uniform) * static_cast<double>(interval)) + 1;
+			return first ? 0 : interval;
+		}
+
+		ACHERON_NOINLINE static void *allocate_sampled(const size_t bytes)
+		{
+			void *p = bytes >= LARGE_THRESHOLD ? allocate_large(bytes) : allocate_from_size_class(get_size_class(bytes));
+			if (p)
+			{
+				if (const size_t interval = next_sample(thread_cache))
+					record_sample(p, bytes, interval);
+			}
+			return p;
+		}
+
+		static size_t sample_slot(const void *block, const size_t slots)
+		{
+			return ((reinterpret_cast<uintptr_t>(block) >> 3) * 0x9E3779B97F4A7C15ULL >> 32) & (slots - 1);
+		}
+
+		/* expects the sample lock to be held; nullptr if the block is not sampled */
+		static Sample *find_sample(const void *block)
+		{
+			auto& state = get_central_state();
+			if (!state.sample_count)
+				return nullptr;
+
+			for (size_t i = sample_slot(block, state.sample_slots);; i = (i + 1) & (state.sample_slots - 1))
+			{
+				if (state.samples[i].block == block)
+					return &state.samples[i];
+				if (!state.samples[i].block)
+					return nullptr;
+			}
+		}
+
+		/* expects the sample lock to be held; false if the table could not grow */
+		static bool insert_sample(const Sample &sample)
+		{
+			auto& state = get_central_state();
+			if (2 * (state.sample_count + 1) > state.sample_slots)
+			{
+				const size_t slots = state.sample_slots ? 2 * state.sample_slots : MIN_SAMPLE_SLOTS;
+				void *mem = mmap(nullptr, slots * sizeof(Sample), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (mem == MAP_FAILED)
+					return false;
+
+				Sample *old = state.samples;
+				const size_t old_slots = state.sample_slots;
+				state.samples = static_cast<Sample *>(mem);
+				state.sample_slots = slots;
+				for (size_t i = 0; i < old_slots; ++i)
+				{
+					if (old[i].block)
+						place_sample(old[i]);
+				}
+				if (old)
+					munmap(old, old_slots * sizeof(Sample));
+			}
+
+			place_sample(sample);
+			++state.sample_count;
+			return true;
+		}
+
+		static void place_sample(const Sample &sample)
+		{
+			auto& state = get_central_state();
+			size_t i = sample_slot(sample.block, state.sample_slots);
+			while (state.samples[i].block)
+				i = (i + 1) & (state.sample_slots - 1);
+			state.samples[i] = sample;
+		}
+
+		/* backward-shift deletion, so lookups never need tombstones; expects the sample lock
+		 * to be held */
+		static void erase_sample(Sample *sample)
+		{
+			auto& state = get_central_state();
+			const size_t mask = state.sample_slots - 1;
+			size_t hole = sample - state.samples;
+			for (size_t i = (hole + 1) & mask; state.samples[i].block; i = (i + 1) & mask)
+			{
+				/* an entry may fill the hole unless its home slot lies cyclically in (hole, i] */
+				const size_t home = sample_slot(state.samples[i].block, state.sample_slots);
+				if (((i - home) & mask) >= ((i - hole) & mask))
+				{
+					state.samples[hole] = state.samples[i];
+					hole = i;
+				}
+			}
+			state.samples[hole].block = nullptr;
+			--state.sample_count;
+		}
+
+		/* records where a block was allocated from; the block must not be visible to any
+		 * other thread yet */
+		ACHERON_NOINLINE static void record_sample(void *block, const size_t bytes, const size_t interval)
+		{
+			Sample sample;
+			sample.block = block;
+			sample.bytes = bytes;
+			/* a block of b bytes is sampled with probability 1 - exp(-b / interval) */
+			sample.weight = static_cast<size_t>(static_cast<double>(bytes) /
+			                                    -std::expm1(-static_cast<double>(bytes) / static_cast<double>(interval)));
+
+			void *frames[MAX_SAMPLE_FRAMES + 2];
+			const int depth = backtrace(frames, MAX_SAMPLE_FRAMES + 2);
+			/* leave out this function and the sampling entry point */
+			sample.depth = depth > 2 ? static_cast<size_t>(depth - 2) : 0;
+			std::memcpy(sample.frames, frames + 2, sample.depth * sizeof(void *));
+
+			auto& state = get_central_state();
+			std::lock_guard guard(state.sample_lock);
+			if (!insert_sample(sample))
+				return;
+
+			Segment *segment = segment_of(block);
+			if (segment->mapped)
+			{
+				segment->sampled = true;
+				return;
+			}
+			Span *span = span_of(block);
+			++span->samples;
+			span->sampled.store(span->sampled.load(memory_order::relaxed) | sample_bit(block), memory_order::relaxed);
+		}
+
+		/* drops the sample of a block about to be freed, if it has one */
+		ACHERON_NOINLINE static void forget_sample(const void *block)
+		{
+			auto& state = get_central_state();
+			std::lock_guard guard(state.sample_lock);
+			Sample *sample = find_sample(block);
+			if (!sample)
+				return; /* another block with the same filter bit */
+			erase_sample(sample);
+
+			Segment *segment = segment_of(block);
+			if (segment->mapped)
+			{
+				segment->sampled = false;
+				return;
+			}
+			/* bits of the remaining samples cannot be told apart, so the filter is only
+			 * cleared once the span has none left */
+			Span *span = span_of(block);
+			if (--span->samples == 0)
+				span->sampled.store(0, memory_order::relaxed);
+		}
+
+		/* keys the sample of a large block to the address it was moved to */
+		static void move_sample(const void *from, const void *to)
+		{
+			auto& state = get_central_state();
+			std::lock_guard guard(state.sample_lock);
+			if (Sample *sample = find_sample(from))
+			{
+				Sample moved = *sample;
+				moved.block = to;
+				erase_sample(sample);
+				insert_sample(moved);
+			}
+		}
+	#endif
+
+	public:
+		/**
+		 * @brief Counters and occupancy of one size class
+		 *
+		 * @note allocations, frees and live_blocks stay zero when ACHERON_ALLOCATOR_STATS is 0
+		 */
+		struct class_statistics
+		{
+			size_t block_size;      /* bytes per block */
+			uint64_t allocations;   /* blocks handed out so far */
+			uint64_t frees;         /* blocks given back so far */
+			uint64_t live_blocks;   /* blocks currently owned by callers */
+			size_t spans;           /* spans currently carved for the class */
+			size_t span_bytes;      /* bytes covered by those spans */
+			size_t cached_blocks;   /* free blocks sitting in thread caches */
+			size_t free_blocks;     /* free or never carved blocks left in the spans */
+		};
+
+		/**
+		 * @brief Snapshot of the whole heap, see ach::allocator_stats
+		 */
+		struct statistics
+		{
+			class_statistics classes[SIZE_CLASSES];
+			size_t segments;            /* 4 MiB segments mapped for spans */
+			size_t segment_bytes;
+			size_t dirty_bytes;         /* free slices still committed */
+			uint64_t large_allocations; /* large blocks handed out so far */
+			uint64_t large_frees;       /* large blocks given back so far */
+			size_t large_bytes;         /* bytes currently mapped for live large blocks */
+			size_t large_cached_bytes;  /* bytes of freed large blocks kept for reuse */
+		};
+
+		/**
+		 * @brief Take a snapshot of the heap
+		 *
+		 * @note Holds the central lock while walking the segments, so keep it off hot paths.
+		 *  Counters of other threads are read while they keep running, so the figures are a
+		 *  close approximation rather than an atomic picture.
+		 */
+		static statistics stats()
+		{
+			statistics result = {};
+			auto& state = get_central_state();
+			uint64_t handed_out[SIZE_CLASSES] = {};
+
+			std::lock_guard guard(state.lock);
+			for (Segment *segment = state.segments; segment; segment = segment->next)
+			{
+				++result.segments;
+				for (size_t i = 1; i < SLICES; ++i)
+				{
+					if (!(segment->used_slices & (1ULL << i)) || segment->span_of[i] != i)
+						continue;
+
+					const Span &span = segment->spans[i];
+					const SizeClass &sc = size_classes.classes[span.size_class];
+					class_statistics &cls = result.classes[span.size_class];
+					++cls.spans;
+					cls.span_bytes += sc.slices * SLICE_SIZE;
+					const uint32_t used = span.used.load(memory_order::relaxed);
+					cls.free_blocks += sc.blocks - used;
+					handed_out[span.size_class] += used;
+				}
+			}
+			result.segment_bytes = result.segments * SEGMENT_SIZE;
+			result.dirty_bytes = state.dirty_bytes;
+			{
+				std::lock_guard large_guard(state.large_lock);
+				result.large_cached_bytes = state.large_cached_bytes;
+			}
+
+			for (size_t i = 0; i < SIZE_CLASSES; ++i)
+			{
+				class_statistics &cls = result.classes[i];
+				cls.block_size = size_classes.classes[i].size;
+
+			#if ACHERON_ALLOCATOR_STATS
+				cls.allocations = state.allocations[i];
+				cls.frees = state.frees[i];
+				for (const ThreadCache *cache = state.caches; cache; cache = cache->next)
+				{
+					cls.allocations += cache->allocations[i].load(memory_order::relaxed);
+					cls.frees += cache->frees[i].load(memory_order::relaxed);
+				}
+				cls.live_blocks = cls.allocations > cls.frees ? cls.allocations - cls.frees : 0;
+				cls.cached_blocks = handed_out[i] > cls.live_blocks ? handed_out[i] - cls.live_blocks : 0;
+			#endif
+			}
+
+		#if ACHERON_ALLOCATOR_STATS
+			result.large_allocations = state.large_allocations.load(memory_order::relaxed);
+			result.large_frees = state.large_frees.load(memory_order::relaxed);
+			result.large_bytes = state.large_bytes.load(memory_order::relaxed);
+		#endif
+			return result;
+		}
+
+	#if ACHERON_ALLOCATOR_SAMPLING
+		/**
+		 * @brief Live sampled allocations sharing one call stack, see ach::allocator_profile
+		 */
+		struct sample_site
+		{
+			void *const *frames;  /* return addresses, innermost first; only valid during the visit */
+			size_t depth;
+			size_t samples;       /* live sampled blocks allocated from this stack */
+			size_t sampled_bytes; /* bytes those blocks were requested with */
+			size_t bytes;         /* estimated live bytes allocated from this stack */
+		};
+
+		/**
+		 * @brief Visit the live sampled allocations grouped by call stack, largest first
+		 *
+		 * @param visit Called with a const sample_site& for every stack; may allocate
+		 * @return size_t Number of sites visited
+		 * @note The samples are copied out in a single pass under the sample lock; grouping
+		 *  and the visits happen after it is released
+		 */
+		template<typename Visitor>
+		static size_t profile(Visitor &&visit)
+		{
+			auto& state = get_central_state();
+			Sample *samples;
+			size_t count = 0;
+			size_t mapped;
+			{
+				std::lock_guard guard(state.sample_lock);
+				if (!state.sample_count)
+					return 0;
+
+				mapped = (state.sample_count * (sizeof(Sample) + sizeof(sample_site)) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+				void *mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (mem == MAP_FAILED)
+					return 0;
+
+				samples = static_cast<Sample *>(mem);
+				for (size_t i = 0; i < state.sample_slots; ++i)
+				{
+					if (state.samples[i].block)
+						samples[count++] = state.samples[i];
+				}
+			}
+
+			struct unmapper
+			{
+				void *mem;
+				size_t size;
+				~unmapper() { munmap(mem, size); }
+			} scratch { samples, mapped };
+
+			const auto same_stack = [](const Sample &a, const Sample &b)
+			{
+				return a.depth == b.depth && std::memcmp(a.frames, b.frames, a.depth * sizeof(void *)) == 0;
+			};
+			std::sort(samples, samples + count, [](const Sample &a, const Sample &b)
+			{
+				return a.depth != b.depth ? a.depth < b.depth : std::memcmp(a.frames, b.frames, a.depth * sizeof(void *)) < 0;
+			});
+
+			auto *sites = reinterpret_cast<sample_site *>(samples + count);
+			size_t site_count = 0;
+			for (size_t i = 0; i < count;)
+			{
+				sample_site &site = sites[site_count++];
+				site = { samples[i].frames, samples[i].depth, 0, 0, 0 };
+				for (const Sample &first = samples[i]; i < count && same_stack(samples[i], first); ++i)
+				{
+					++site.samples;
+					site.sampled_bytes += samples[i].bytes;
+					site.bytes += samples[i].weight;
+				}
+			}
+			std::sort(sites, sites + site_count, [](const sample_site &a, const sample_site &b) { return a.bytes > b.bytes; });
+
+			for (size_t i = 0; i < site_count; ++i)
+				visit(static_cast<const sample_site &>(sites[i]));
+			return site_count;
+		}
+	#endif
+
+	private:
+	#ifdef ACHERON_ALLOCATOR_DEBUG
+		[[noreturn]] static void invalid_free(const void *p, const size_t bytes, const char *why) noexcept
+		{
+			std::fprintf(stderr, "ach::heap: invalid deallocate(%p, %zu): %s\n", p, bytes, why);
+			std::abort();
+		}
+
+		/* checks everything the sized fast path takes on trust */
+		static void validate(const void *p, const size_t bytes) noexcept
+		{
+			const Segment *segment = segment_of(p);
+			if (segment->magic != SEGMENT_MAGIC)
+				invalid_free(p, bytes, "pointer does not belong to the heap");
+
+			if (segment->mapped)
+			{
+				if (bytes < LARGE_THRESHOLD || segment->mapped < large_mapping(bytes) ||
+				    p != reinterpret_cast<const uint8_t *>(segment) + PAGE_SIZE)
+					invalid_free(p, bytes, "size or address does not match the large block");
+				return;
+			}
+
+			const Span *span = span_of(p);
+			const size_t size = size_classes.classes[span->size_class].size;
+			const auto *block = static_cast<const uint8_t *>(p);
+			if (!(segment->used_slices & (1ULL << (span - segment->spans))) || block < span->start ||
+			    block >= span->bump || (block - span->start) % size != 0)
+				invalid_free(p, bytes, "pointer is not the start of a live block");
+			if (bytes >= LARGE_THRESHOLD || get_size_class(bytes) != span->size_class)
+				invalid_free(p, bytes, "size does not match the block's size class");
+		}
+	#endif
+	};
+
+	/**
+	 * @brief Return free memory held by the allocator to the operating system
+	 *
+	 * @param keep_bytes Free bytes the allocator may keep committed for future requests
+	 * @return size_t Number of bytes released
+	 * @note The allocator already does this on its own once enough free memory builds up;
+	 *  call it after a known peak, e.g. when a large batch of containers has been destroyed
+	 */
+	LIBACHERON size_t allocator_trim(const size_t keep_bytes = 0)
+	{
+		return heap::trim(keep_bytes);
+	}
+
+	/**
+	 * @brief Map and fault in memory for `count` blocks of `bytes` bytes before they are needed
+	 *
+	 * @return size_t Number of blocks reserved; less than `count` only if out of memory
+	 * @note Meant for startup: after reserving the sizes a service is known to use, its first
+	 *  requests find committed, faulted-in memory instead of paying for mmap and page faults.
+	 *  Set allocator_config::pinned as well to keep the memory from being trimmed away while
+	 *  it sits unused. See heap::reserve.
+	 */
+	LIBACHERON size_t allocator_reserve(const size_t bytes, const size_t count)
+	{
+		return heap::reserve(bytes, count);
+	}
+
+	using allocator_statistics = heap::statistics;
+
+	/**
+	 * @brief Snapshot of how much memory the allocator holds and where
+	 *
+	 * @return allocator_statistics Per size-class counters and occupancy, segment and large
+	 *  block totals
+	 * @note The per-class counters cost a plain increment on every allocation and free;
+	 *  define ACHERON_ALLOCATOR_STATS to 0 to compile them out. Occupancy figures are
+	 *  always available since they are read from the heap's own metadata.
+	 */
+	LIBACHERON allocator_statistics allocator_stats()
+	{
+		return heap::stats();
+	}
+
+	using huge_page_policy = heap::huge_page_policy;
+	using allocator_config = heap::config;
+
+	/**
+	 * @brief Choose how the allocator maps memory from the operating system
+	 *
+	 * @param settings The policies to use from now on; mappings made before keep theirs
+	 * @note huge_page_policy::transparent advises every mapping of at least
+	 *  huge_page_threshold bytes with MADV_HUGEPAGE, which covers span segments and large
+	 *  blocks alike. huge_page_policy::hugetlb additionally takes large blocks from the
+	 *  reserved MAP_HUGETLB pool, rounded up to whole 2 MiB pages; such blocks cannot be
+	 *  resized in place beyond that rounding, and a missing or exhausted pool falls back to
+	 *  regular mappings. populate pre-faults large blocks, and the part they grow by, so the
+	 *  first pass over them does not stall on page faults.
+	 * @note Freed large blocks of up to large_cache_limit bytes in total are kept for reuse
+	 *  by later large allocations of about the same size. Blocks idle for longer than
+	 *  large_cache_decay_ms are unmapped by the next large allocation or free, or by
+	 *  ach::allocator_trim; a limit of zero turns the cache off.
+	 * @note pinned keeps free memory committed for as long as it is set: free slices are not
+	 *  purged, cached large blocks do not decay (large_cache_limit still applies) and
+	 *  ach::allocator_trim does nothing. Combined with ach::allocator_reserve, memory is only
+	 *  acquired up front.
+	 */
+	LIBACHERON void allocator_configure(const allocator_config &settings) noexcept
+	{
+		heap::configure(settings);
+	}
+
+	/**
+	 * @brief The policies set by the last call to ach::allocator_configure
+	 */
+	LIBACHERON allocator_config allocator_configuration() noexcept
+	{
+		return heap::configuration();
+	}
+
+#if ACHERON_ALLOCATOR_SAMPLING
+	using allocator_sample_site = heap::sample_site;
+
+	/**
+	 * @brief Visit the live sampled allocations grouped by call stack, largest first
+	 *
+	 * @param visit Called with a const allocator_sample_site& for every call stack
+	 * @return size_t Number of call stacks visited
+	 * @note Sampling is off until allocator_config::sample_interval is set. Every
+	 *  sample_interval bytes allocated on average, the call stack of the allocation is
+	 *  captured with backtrace(3) and kept until the block is freed; bytes estimates the
+	 *  live memory allocated from each stack, scaled up from the samples. At an interval of
+	 *  512 KiB even a loop doing nothing but allocating and freeing slows down by only a few
+	 *  percent, so it can be left on in production.
+	 * @note Threads notice sampling being turned on within a MiB of allocations
+	 */
+	template<typename Visitor>
+	size_t allocator_profile(Visitor &&visit)
+	{
+		return heap::profile(std::forward<Visitor>(visit));
+	}
+
+	/**
+	 * @brief Write the live sampled allocations grouped by call stack to a file descriptor
+	 *
+	 * @param fd Where to write the report; stderr by default
+	 * @note Stacks are symbolized with backtrace_symbols_fd(3), so link with -rdynamic to get
+	 *  function names; see ach::allocator_profile
+	 */
+	LIBACHERON void allocator_profile_dump(const int fd = 2)
+	{
+		size_t sites = 0;
+		size_t samples = 0;
+		size_t bytes = 0;
+		heap::profile([&](const allocator_sample_site &site)
+		{
+			dprintf(fd, "#%zu: %zu bytes in %zu samples (%zu bytes sampled)\n", ++sites, site.bytes, site.samples, site.sampled_bytes);
+			backtrace_symbols_fd(const_cast<void **>(site.frames), static_cast<int>(site.depth), fd);
+			samples += site.samples;
+			bytes += site.bytes;
+		});
+		dprintf(fd, "total: %zu bytes in %zu samples from %zu call stacks\n", bytes, samples, sites);
+	}
+#endif
+}
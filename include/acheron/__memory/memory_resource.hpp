@@ -0,0 +1,695 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <acheron/__atomic/atomic.hpp>
+#include <acheron/__libdef.hpp>
+#include <acheron/__memory/arena.hpp>
+#include <acheron/__memory/heap.hpp>
+
+namespace ach::pmr
+{
+	/**
+	 * @brief Interface of an allocation strategy picked at runtime
+	 *
+	 * @note Same contract as std::pmr::memory_resource: allocate throws std::bad_alloc on
+	 *  failure, and a block must be deallocated with the size and alignment it was allocated
+	 *  with, through a resource comparing equal to the one it came from.
+	 */
+	class memory_resource
+	{
+	public:
+		memory_resource() = default;
+		memory_resource(const memory_resource &) = default;
+		memory_resource &operator=(const memory_resource &) = default;
+		virtual ~memory_resource() = default;
+
+		/**
+		 * @brief Allocate `bytes` bytes aligned to `align`
+		 *
+		 * @param align Required alignment; must be a power of two
+		 * @throw std::bad_alloc if the memory could not be obtained
+		 */
+		[[nodiscard]] void *allocate(const size_t bytes, const size_t align = alignof(std::max_align_t))
+		{
+			return do_allocate(bytes, align);
+		}
+
+		/**
+		 * @brief Return a block obtained from allocate with the same size and alignment
+		 */
+		void deallocate(void *p, const size_t bytes, const size_t align = alignof(std::max_align_t)) noexcept
+		{
+			do_deallocate(p, bytes, align);
+		}
+
+		/**
+		 * @brief Whether memory allocated from one resource may be deallocated through the other
+		 */
+		[[nodiscard]] bool is_equal(const memory_resource &other) const noexcept
+		{
+			return do_is_equal(other);
+		}
+
+	private:
+		virtual void *do_allocate(size_t bytes, size_t align) = 0;
+		virtual void do_deallocate(void *p, size_t bytes, size_t align) noexcept = 0;
+		virtual bool do_is_equal(const memory_resource &other) const noexcept = 0;
+	};
+
+	LIBACHERON bool operator==(const memory_resource &lhs, const memory_resource &rhs) noexcept
+	{
+		return &lhs == &rhs || lhs.is_equal(rhs);
+	}
+
+	LIBACHERON bool operator!=(const memory_resource &lhs, const memory_resource &rhs) noexcept
+	{
+		return !(lhs == rhs);
+	}
+
+	/**
+	 * @brief Resource allocating from ach::heap, the memory behind ach::allocator
+	 *
+	 * @note Alignments above the natural one go through heap::allocate_aligned; those above
+	 *  heap::MAX_ALIGNMENT throw std::bad_alloc
+	 */
+	class heap_memory_resource final : public memory_resource
+	{
+	private:
+		void *do_allocate(const size_t bytes, const size_t align) override
+		{
+			void *result = heap::allocate_aligned(bytes == 0 ? 1 : bytes, align);
+			if (!result)
+				throw std::bad_alloc();
+			return result;
+		}
+
+		void do_deallocate(void *p, const size_t bytes, const size_t align) noexcept override
+		{
+			heap::deallocate_aligned(p, bytes == 0 ? 1 : bytes, align);
+		}
+
+		bool do_is_equal(const memory_resource &other) const noexcept override
+		{
+			return dynamic_cast<const heap_memory_resource *>(&other) != nullptr;
+		}
+	};
+
+	/**
+	 * @brief The process-wide ach::heap resource
+	 *
+	 * @note Never destroyed, so containers with static storage duration can still release
+	 *  their memory through it at exit
+	 */
+	LIBACHERON memory_resource *heap_resource() noexcept
+	{
+		union holder
+		{
+			heap_memory_resource resource;
+			holder() : resource() {}
+			~holder() {}
+		};
+		static holder instance;
+		return &instance.resource;
+	}
+
+	namespace __detail
+	{
+		LIBACHERON atomic<memory_resource *> &default_resource() noexcept
+		{
+			static atomic<memory_resource *> resource { heap_resource() };
+			return resource;
+		}
+	}
+
+	/**
+	 * @brief The resource default-constructed polymorphic allocators use; heap_resource() unless replaced
+	 */
+	LIBACHERON memory_resource *get_default_resource() noexcept
+	{
+		return __detail::default_resource().load(memory_order::acquire);
+	}
+
+	/**
+	 * @brief Replace the default resource
+	 *
+	 * @param resource The new default, or nullptr for heap_resource()
+	 * @return memory_resource* The previous default
+	 */
+	LIBACHERON memory_resource *set_default_resource(memory_resource *resource) noexcept
+	{
+		return __detail::default_resource().exchange(resource ? resource : heap_resource(), memory_order::acq_rel);
+	}
+
+	/**
+	 * @brief Resource drawing from an ach::arena
+	 *
+	 * @note Deallocation is a no-op; the memory comes back when the arena is reset or
+	 *  released, so the arena has to outlive every container using this resource
+	 */
+	class arena_resource final : public memory_resource
+	{
+	public:
+		explicit arena_resource(ach::arena &source) noexcept : source(&source) {}
+
+		/**
+		 * @brief The arena this resource draws from
+		 */
+		[[nodiscard]] ach::arena &arena() const noexcept
+		{
+			return *source;
+		}
+
+	private:
+		ach::arena *source;
+
+		void *do_allocate(const size_t bytes, const size_t align) override
+		{
+			void *result = source->allocate(bytes, align);
+			if (!result)
+				throw std::bad_alloc();
+			return result;
+		}
+
+		void do_deallocate(void *, size_t, size_t) noexcept override {}
+
+		bool do_is_equal(const memory_resource &other) const noexcept override
+		{
+			const auto *resource = dynamic_cast<const arena_resource *>(&other);
+			return resource && resource->source == source;
+		}
+	};
+
+	/**
+	 * @brief Bump-pointer resource that only frees memory when it is released or destroyed
+	 *
+	 * @note Starts from an optional caller-provided buffer, then takes chunks from its
+	 *  upstream resource, each twice the size of the previous one. Deallocation is a no-op.
+	 *  Like ach::arena, but any resource can supply the chunks, e.g. a stack buffer for the
+	 *  common case and the heap past it.
+	 *
+	 * @note Not thread-safe
+	 */
+	class monotonic_buffer_resource final : public memory_resource
+	{
+	public:
+		static constexpr size_t DEFAULT_CHUNK_SIZE = 1024;
+
+		explicit monotonic_buffer_resource(memory_resource *upstream = get_default_resource()) noexcept
+			: monotonic_buffer_resource(DEFAULT_CHUNK_SIZE, upstream) {}
+
+		/**
+		 * @param initial_size Size of the first chunk taken from upstream
+		 */
+		explicit monotonic_buffer_resource(const size_t initial_size, memory_resource *upstream = get_default_resource()) noexcept
+			: upstream(upstream), initial_size(initial_size < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : initial_size),
+			  next_size(this->initial_size) {}
+
+		/**
+		 * @param buffer Memory served first; owned by the caller and never freed
+		 * @param size Size of buffer in bytes
+		 */
+		monotonic_buffer_resource(void *buffer, const size_t size, memory_resource *upstream = get_default_resource()) noexcept
+			: upstream(upstream), buffer(static_cast<uint8_t *>(buffer)), buffer_size(size),
+			  initial_size(size < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : size), next_size(initial_size)
+		{
+			enter(this->buffer, size);
+		}
+
+		ACHERON_NOCOPY(monotonic_buffer_resource)
+		ACHERON_NOMOVE(monotonic_buffer_resource)
+
+		~monotonic_buffer_resource() override
+		{
+			release();
+		}
+
+		/**
+		 * @brief Give every chunk back to upstream and start over from the initial buffer
+		 *
+		 * @note Every pointer handed out so far becomes dangling
+		 */
+		void release() noexcept
+		{
+			while (chunks)
+			{
+				Chunk *next = chunks->next;
+				upstream->deallocate(chunks, chunks->size, alignof(Chunk));
+				chunks = next;
+			}
+
+			next_size = initial_size;
+			enter(buffer, buffer_size);
+		}
+
+		[[nodiscard]] memory_resource *upstream_resource() const noexcept
+		{
+			return upstream;
+		}
+
+	private:
+		static constexpr size_t MIN_CHUNK_SIZE = 64;
+
+		struct Chunk
+		{
+			Chunk *next;
+			size_t size; /* including this header */
+		};
+
+		memory_resource *upstream;
+		uint8_t *buffer = nullptr;
+		size_t buffer_size = 0;
+		Chunk *chunks = nullptr; /* most recent first */
+		uintptr_t cursor = 0;
+		uintptr_t limit = 0;
+		size_t initial_size;
+		size_t next_size;
+
+		void enter(uint8_t *start, const size_t size) noexcept
+		{
+			cursor = reinterpret_cast<uintptr_t>(start);
+			limit = cursor + size;
+		}
+
+		void *do_allocate(const size_t bytes, const size_t align) override
+		{
+			const uintptr_t p = (cursor + align - 1) & ~(align - 1);
+			if (ACHERON_LIKELY(cursor && p >= cursor && p <= limit && bytes <= limit - p))
+			{
+				cursor = p + bytes;
+				return reinterpret_cast<void *>(p);
+			}
+
+			return allocate_slow(bytes, align);
+		}
+
+		ACHERON_NOINLINE void *allocate_slow(const size_t bytes, const size_t align)
+		{
+			const size_t needed = sizeof(Chunk) + bytes + align;
+			if (needed < bytes)
+				throw std::bad_alloc(); /* overflow */
+
+			while (next_size < needed && next_size <= std::numeric_limits<size_t>::max() / 2)
+				next_size *= 2;
+			const size_t size = next_size < needed ? needed : next_size;
+
+			auto *chunk = static_cast<Chunk *>(upstream->allocate(size, alignof(Chunk)));
+			chunk->next = chunks;
+			chunk->size = size;
+			chunks = chunk;
+			if (next_size <= std::numeric_limits<size_t>::max() / 2)
+				next_size *= 2;
+
+			enter(reinterpret_cast<uint8_t *>(chunk + 1), size - sizeof(Chunk));
+			const uintptr_t p = (cursor + align - 1) & ~(align - 1);
+			cursor = p + bytes;
+			return reinterpret_cast<void *>(p);
+		}
+
+		void do_deallocate(void *, size_t, size_t) noexcept override {}
+
+		bool do_is_equal(const memory_resource &other) const noexcept override
+		{
+			return this == &other;
+		}
+	};
+
+	/**
+	 * @brief Tuning of a pool resource
+	 *
+	 * @note Zero picks the default; values out of range are clamped
+	 */
+	struct pool_options
+	{
+		size_t max_blocks_per_chunk = 0;        /* chunks grow from a few blocks up to this many */
+		size_t largest_required_pool_block = 0; /* larger requests go straight to upstream */
+	};
+
+	/**
+	 * @brief Resource keeping free lists of power-of-two blocks, without any locking
+	 *
+	 * @note Requests up to largest_required_pool_block bytes are served from one pool per
+	 *  power of two; each pool carves chunks taken from upstream and recycles freed blocks,
+	 *  but only gives memory back on release() or destruction. Larger requests are forwarded
+	 *  to upstream and tracked so release() frees them too.
+	 *
+	 * @note Not thread-safe; meant for memory owned by one thread or request at a time, where
+	 *  it avoids even the thread-cache lookups of ach::heap
+	 */
+	class unsynchronized_pool_resource final : public memory_resource
+	{
+	public:
+		unsynchronized_pool_resource() : unsynchronized_pool_resource(pool_options(), get_default_resource()) {}
+
+		explicit unsynchronized_pool_resource(memory_resource *upstream) : unsynchronized_pool_resource(pool_options(), upstream) {}
+
+		explicit unsynchronized_pool_resource(const pool_options &options, memory_resource *upstream = get_default_resource())
+			: upstream(upstream)
+		{
+			size_t largest = options.largest_required_pool_block ? options.largest_required_pool_block : DEFAULT_LARGEST_BLOCK;
+			largest = largest < MIN_BLOCK ? MIN_BLOCK : largest > MAX_LARGEST_BLOCK ? MAX_LARGEST_BLOCK : largest;
+			pool_count = pool_index(largest) + 1;
+
+			const size_t blocks = options.max_blocks_per_chunk ? options.max_blocks_per_chunk : DEFAULT_MAX_BLOCKS;
+			max_blocks = blocks < MIN_BLOCKS ? MIN_BLOCKS : blocks > MAX_BLOCKS ? MAX_BLOCKS : blocks;
+		}
+
+		ACHERON_NOCOPY(unsynchronized_pool_resource)
+		ACHERON_NOMOVE(unsynchronized_pool_resource)
+
+		~unsynchronized_pool_resource() override
+		{
+			release();
+		}
+
+		/**
+		 * @brief Give every chunk and every large block back to upstream
+		 *
+		 * @note Every pointer handed out so far becomes dangling
+		 */
+		void release() noexcept
+		{
+			for (size_t i = 0; i < pool_count; ++i)
+			{
+				Pool &pool = pools[i];
+				while (pool.chunks)
+				{
+					Chunk *next = pool.chunks->next;
+					upstream->deallocate(pool.chunks->start, pool.chunks->bytes, block_size(i));
+					pool.chunks = next;
+				}
+				pool = Pool();
+			}
+
+			while (oversized)
+			{
+				Oversized *next = oversized->next;
+				const size_t offset = oversized_offset(oversized->align);
+				upstream->deallocate(reinterpret_cast<uint8_t *>(oversized + 1) - offset, oversized->bytes + offset,
+				                     oversized_align(oversized->align));
+				oversized = next;
+			}
+		}
+
+		[[nodiscard]] memory_resource *upstream_resource() const noexcept
+		{
+			return upstream;
+		}
+
+		/**
+		 * @brief The options in effect after defaults and clamping
+		 */
+		[[nodiscard]] pool_options options() const noexcept
+		{
+			return { max_blocks, block_size(pool_count - 1) };
+		}
+
+	private:
+		static constexpr size_t MIN_BLOCK_SHIFT = 3;
+		static constexpr size_t MIN_BLOCK = 1ULL << MIN_BLOCK_SHIFT;
+		static constexpr size_t DEFAULT_LARGEST_BLOCK = 4096;
+		static constexpr size_t MAX_LARGEST_BLOCK = 64 * 1024;
+		static constexpr size_t POOLS = 14; /* 8 bytes to 64 KiB */
+		static constexpr size_t MIN_BLOCKS = 8; /* blocks in the first chunk of a pool */
+		static constexpr size_t DEFAULT_MAX_BLOCKS = 1024;
+		static constexpr size_t MAX_BLOCKS = 64 * 1024;
+
+		struct FreeBlock
+		{
+			FreeBlock *next;
+		};
+
+		/* sits after the blocks, so those stay aligned to their size */
+		struct Chunk
+		{
+			Chunk *next;
+			void *start;
+			size_t bytes; /* including this trailer */
+		};
+
+		struct Pool
+		{
+			FreeBlock *free = nullptr;
+			uint8_t *bump = nullptr; /* never-carved part of the newest chunk */
+			uint8_t *end = nullptr;
+			Chunk *chunks = nullptr;
+			size_t next_blocks = MIN_BLOCKS;
+		};
+
+		/* precedes every request too large for the pools */
+		struct Oversized
+		{
+			Oversized *next;
+			Oversized *prev;
+			size_t bytes;
+			size_t align;
+		};
+
+		memory_resource *upstream;
+		Pool pools[POOLS];
+		size_t pool_count;
+		size_t max_blocks;
+		Oversized *oversized = nullptr;
+
+		static size_t block_size(const size_t index) noexcept
+		{
+			return MIN_BLOCK << index;
+		}
+
+		static size_t pool_index(const size_t size) noexcept
+		{
+			return size <= MIN_BLOCK ? 0 : 64 - __builtin_clzll(size - 1) - MIN_BLOCK_SHIFT;
+		}
+
+		static size_t oversized_offset(const size_t align) noexcept
+		{
+			return (sizeof(Oversized) + align - 1) & ~(align - 1);
+		}
+
+		static size_t oversized_align(const size_t align) noexcept
+		{
+			return align < alignof(Oversized) ? alignof(Oversized) : align;
+		}
+
+		void *do_allocate(const size_t bytes, const size_t align) override
+		{
+			const size_t size = bytes < align ? align : bytes;
+			const size_t index = pool_index(size);
+			if (ACHERON_UNLIKELY(index >= pool_count))
+				return allocate_oversized(bytes, align);
+
+			Pool &pool = pools[index];
+			if (FreeBlock *block = pool.free)
+			{
+				pool.free = block->next;
+				return block;
+			}
+			if (ACHERON_LIKELY(pool.bump < pool.end))
+			{
+				void *block = pool.bump;
+				pool.bump += block_size(index);
+				return block;
+			}
+			return refill(index);
+		}
+
+		void do_deallocate(void *p, const size_t bytes, const size_t align) noexcept override
+		{
+			const size_t size = bytes < align ? align : bytes;
+			const size_t index = pool_index(size);
+			if (ACHERON_UNLIKELY(index >= pool_count))
+			{
+				deallocate_oversized(p, bytes, align);
+				return;
+			}
+
+			auto *block = static_cast<FreeBlock *>(p);
+			block->next = pools[index].free;
+			pools[index].free = block;
+		}
+
+		bool do_is_equal(const memory_resource &other) const noexcept override
+		{
+			return this == &other;
+		}
+
+		/* takes a new chunk for a pool, each one holding twice the blocks of the previous */
+		ACHERON_NOINLINE void *refill(const size_t index)
+		{
+			Pool &pool = pools[index];
+			const size_t size = block_size(index);
+			const size_t blocks = pool.next_blocks < max_blocks ? pool.next_blocks : max_blocks;
+			const size_t bytes = blocks * size + sizeof(Chunk);
+
+			auto *start = static_cast<uint8_t *>(upstream->allocate(bytes, size));
+			auto *chunk = reinterpret_cast<Chunk *>(start + blocks * size);
+			chunk->next = pool.chunks;
+			chunk->start = start;
+			chunk->bytes = bytes;
+			pool.chunks = chunk;
+			if (pool.next_blocks < max_blocks)
+				pool.next_blocks *= 2;
+
+			pool.bump = start + size;
+			pool.end = start + blocks * size;
+			return start;
+		}
+
+		ACHERON_NOINLINE void *allocate_oversized(const size_t bytes, const size_t align)
+		{
+			const size_t offset = oversized_offset(align);
+			if (bytes + offset < bytes)
+				throw std::bad_alloc(); /* overflow */
+
+			auto *raw = static_cast<uint8_t *>(upstream->allocate(bytes + offset, oversized_align(align)));
+			auto *header = reinterpret_cast<Oversized *>(raw + offset) - 1;
+			header->bytes = bytes;
+			header->align = align;
+			header->prev = nullptr;
+			header->next = oversized;
+			if (oversized)
+				oversized->prev = header;
+			oversized = header;
+			return raw + offset;
+		}
+
+		void deallocate_oversized(void *p, const size_t bytes, const size_t align) noexcept
+		{
+			auto *header = static_cast<Oversized *>(p) - 1;
+			if (header->prev)
+				header->prev->next = header->next;
+			else
+				oversized = header->next;
+			if (header->next)
+				header->next->prev = header->prev;
+
+			const size_t offset = oversized_offset(align);
+			upstream->deallocate(static_cast<uint8_t *>(p) - offset, bytes + offset, oversized_align(align));
+		}
+	};
+
+	/**
+	 * @brief Allocator forwarding to a memory_resource chosen at runtime
+	 *
+	 * @note Containers using it share one type whatever the resource, so a function taking an
+	 *  ach::pmr::vector<int>& accepts vectors living on the heap, in an arena or in a pool.
+	 *  A default-constructed allocator uses get_default_resource().
+	 *
+	 * @note Unlike std::pmr::polymorphic_allocator, the resource travels with the memory on
+	 *  copy, assignment and swap, as ach containers always carry their allocator along; the
+	 *  same holds for ach::arena_allocator.
+	 *
+	 * @note construct() hands this allocator to objects taking one as their last constructor
+	 *  argument, which code going through std::allocator_traits relies on. ach containers
+	 *  construct elements in place instead, so a nested pmr container needs its resource
+	 *  passed explicitly.
+	 * @tparam T Type of objects to allocate
+	 */
+	template<typename T>
+	class polymorphic_allocator
+	{
+	public:
+		using value_type = T;
+		using pointer = T *;
+		using const_pointer = const T *;
+		using reference = T &;
+		using const_reference = const T &;
+		using size_type = size_t;
+		using difference_type = ptrdiff_t;
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+		using is_always_equal = std::false_type;
+
+		template<typename U>
+		struct rebind
+		{
+			using other = polymorphic_allocator<U>;
+		};
+
+		polymorphic_allocator() noexcept : source(get_default_resource()) {}
+
+		/**
+		 * @brief Create an allocator drawing from `resource`; it has to outlive the allocator
+		 */
+		polymorphic_allocator(memory_resource *resource) noexcept : source(resource) {}
+
+		polymorphic_allocator(const polymorphic_allocator &other) noexcept = default;
+		polymorphic_allocator &operator=(const polymorphic_allocator &other) noexcept = default;
+
+		template<typename U>
+		polymorphic_allocator(const polymorphic_allocator<U> &other) noexcept : source(other.resource()) {}
+
+		/**
+		 * @brief Allocate memory for n objects of type T
+		 *
+		 * @return pointer The memory, or nullptr if n is zero
+		 * @throw std::bad_alloc if the resource is out of memory
+		 */
+		[[nodiscard]] pointer allocate(size_type n)
+		{
+			if (n == 0)
+				return nullptr;
+
+			if (n > max_size())
+				throw std::bad_array_new_length();
+
+			return static_cast<pointer>(source->allocate(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(pointer p, size_type n) noexcept
+		{
+			if (p)
+				source->deallocate(p, n * sizeof(T), alignof(T));
+		}
+
+		[[nodiscard]] size_type max_size() const noexcept
+		{
+			return std::numeric_limits<size_type>::max() / sizeof(T);
+		}
+
+		template<typename U, typename... Args>
+		void construct(U *p, Args &&... args)
+		{
+			if constexpr (std::uses_allocator_v<U, polymorphic_allocator> &&
+			              std::is_constructible_v<U, Args..., const polymorphic_allocator &>)
+				::new(static_cast<void *>(p)) U(std::forward<Args>(args)..., *this);
+			else
+				::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+		}
+
+		template<typename U>
+		void destroy(U *p) noexcept(std::is_nothrow_destructible_v<U>)
+		{
+			p->~U();
+		}
+
+		/**
+		 * @brief The resource this allocator draws from
+		 */
+		[[nodiscard]] memory_resource *resource() const noexcept
+		{
+			return source;
+		}
+
+	private:
+		memory_resource *source;
+	};
+
+	template<typename T1, typename T2>
+	bool operator==(const polymorphic_allocator<T1> &lhs, const polymorphic_allocator<T2> &rhs) noexcept
+	{
+		return *lhs.resource() == *rhs.resource();
+	}
+
+	template<typename T1, typename T2>
+	bool operator!=(const polymorphic_allocator<T1> &lhs, const polymorphic_allocator<T2> &rhs) noexcept
+	{
+		return !(lhs == rhs);
+	}
+}
@@ -0,0 +1,341 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <acheron/__atomic/spin_lock.hpp>
+#include <acheron/__libdef.hpp>
+#include <acheron/__memory/heap.hpp>
+
+namespace ach
+{
+	/**
+	 * @brief Pool of objects of one type, packed densely into slabs
+	 *
+	 * @note Objects sit next to each other with no per-object header; a freed slot holds the
+	 *  free-list link, so a slot is exactly max(sizeof(T), sizeof(void *)) rounded to the
+	 *  alignment. construct() pops the free list or bumps a pointer through the newest slab,
+	 *  destroy() pushes onto the free list. Objects allocated together stay together, which
+	 *  keeps walks over them in few cache lines and pages.
+	 *
+	 * @note Slabs come from ach::heap, starting at MIN_SLAB_SIZE bytes and doubling up to
+	 *  MAX_SLAB_SIZE. clear() destroys every live object and keeps the slabs for reuse,
+	 *  release() gives them back; memory is never returned to the heap otherwise.
+	 *
+	 * @note Not thread-safe unless ThreadSafe is set, in which case construct() and destroy()
+	 *  take a spin lock around the free-list operations; constructors and destructors run
+	 *  outside of it.
+	 * @tparam T Type of the pooled objects
+	 * @tparam ThreadSafe Whether construct() and destroy() may be called concurrently
+	 */
+	template<typename T, bool ThreadSafe = false>
+	class object_pool
+	{
+		ACHERON_STATIC_ASSERT(alignof(T) <= heap::MAX_ALIGNMENT, "alignment of T is not supported by ach::heap");
+
+	public:
+		using value_type = T;
+		using size_type = size_t;
+
+		static constexpr size_t MIN_SLAB_SIZE = 4 * 1024;
+		static constexpr size_t MAX_SLAB_SIZE = 256 * 1024;
+
+		object_pool() noexcept = default;
+
+		ACHERON_NOCOPY(object_pool)
+		ACHERON_NOMOVE(object_pool)
+
+		~object_pool()
+		{
+			release();
+		}
+
+		/**
+		 * @brief Construct an object in the pool
+		 *
+		 * @param args Arguments forwarded to T's constructor
+		 * @return T* The new object
+		 * @throw std::bad_alloc if a new slab could not be obtained; whatever T's constructor throws
+		 */
+		template<typename... Args>
+		[[nodiscard]] T *construct(Args &&... args)
+		{
+			Slot *slot;
+			{
+				std::lock_guard guard(lock);
+				slot = take();
+			}
+
+			if constexpr (std::is_nothrow_constructible_v<T, Args...>)
+				return ::new(static_cast<void *>(slot)) T(std::forward<Args>(args)...);
+			else
+			{
+				try
+				{
+					return ::new(static_cast<void *>(slot)) T(std::forward<Args>(args)...);
+				}
+				catch (...)
+				{
+					std::lock_guard guard(lock);
+					put(slot);
+					throw;
+				}
+			}
+		}
+
+		/**
+		 * @brief Destroy an object obtained from construct() and recycle its slot
+		 */
+		void destroy(T *p) noexcept
+		{
+			if (!p)
+				return;
+
+			p->~T();
+			std::lock_guard guard(lock);
+			put(reinterpret_cast<Slot *>(p));
+		}
+
+		/**
+		 * @brief Destroy every live object and make all slabs available again
+		 *
+		 * @note Every pointer handed out so far becomes dangling. Must not race with construct()
+		 *  or destroy(), even when ThreadSafe is set.
+		 */
+		void clear() noexcept
+		{
+			if constexpr (!std::is_trivially_destructible_v<T>)
+			{
+				if (live)
+					destroy_live();
+			}
+
+			free = nullptr;
+			live = 0;
+			current = first;
+			if (current)
+				enter(current);
+		}
+
+		/**
+		 * @brief Destroy every live object and return every slab to the heap
+		 *
+		 * @note Every pointer handed out so far becomes dangling
+		 */
+		void release() noexcept
+		{
+			clear();
+
+			for (Slab *slab = first; slab;)
+			{
+				Slab *next = slab->next;
+				heap::deallocate_aligned(slab, slab->size, alignof(Slot));
+				slab = next;
+			}
+
+			first = current = nullptr;
+			cursor = limit = nullptr;
+			next_size = MIN_SLAB_SIZE;
+		}
+
+		/**
+		 * @brief Number of live objects
+		 */
+		[[nodiscard]] size_type size() const noexcept
+		{
+			return live;
+		}
+
+		/**
+		 * @brief Number of objects the slabs owned by the pool can hold
+		 */
+		[[nodiscard]] size_type capacity() const noexcept
+		{
+			size_t total = 0;
+			for (const Slab *slab = first; slab; slab = slab->next)
+				total += slab->slots;
+			return total;
+		}
+
+	private:
+		union Slot
+		{
+			Slot *next;
+			alignas(T) unsigned char storage[sizeof(T)];
+		};
+
+		/* slabs form a list in the order they are entered; the ones after `current` are unused */
+		struct Slab
+		{
+			Slab *next;
+			size_t size;   /* bytes, including this header */
+			size_t slots;
+			size_t carved; /* slots handed out at least once since the last clear() */
+		};
+
+		static constexpr size_t SLOTS_OFFSET = (sizeof(Slab) + alignof(Slot) - 1) & ~(alignof(Slot) - 1);
+		static constexpr size_t MIN_SLOTS = 8;
+
+		struct no_lock
+		{
+			void lock() noexcept {}
+			void unlock() noexcept {}
+		};
+
+		[[no_unique_address]] std::conditional_t<ThreadSafe, spin_lock, no_lock> lock;
+		Slot *free = nullptr;
+		Slot *cursor = nullptr;
+		Slot *limit = nullptr;
+		Slab *first = nullptr;
+		Slab *current = nullptr;
+		size_t live = 0;
+		size_t next_size = MIN_SLAB_SIZE;
+
+		static Slot *slots_of(Slab *slab) noexcept
+		{
+			return reinterpret_cast<Slot *>(reinterpret_cast<uint8_t *>(slab) + SLOTS_OFFSET);
+		}
+
+		void enter(Slab *slab) noexcept
+		{
+			slab->carved = 0;
+			cursor = slots_of(slab);
+			limit = cursor + slab->slots;
+		}
+
+		Slot *take()
+		{
+			Slot *slot = free;
+			if (ACHERON_LIKELY(slot))
+				free = slot->next;
+			else if (ACHERON_LIKELY(cursor != limit))
+				slot = cursor++;
+			else
+				slot = take_slow();
+
+			++live;
+			return slot;
+		}
+
+		void put(Slot *slot) noexcept
+		{
+			slot->next = free;
+			free = slot;
+			--live;
+		}
+
+		/* moves on to the next slab kept by clear(), or takes a new one from the heap */
+		ACHERON_NOINLINE Slot *take_slow()
+		{
+			Slab *slab = current ? current->next : first;
+			if (!slab)
+			{
+				size_t size = next_size;
+				if (size < SLOTS_OFFSET + MIN_SLOTS * sizeof(Slot))
+					size = std::bit_ceil(SLOTS_OFFSET + MIN_SLOTS * sizeof(Slot));
+
+				slab = static_cast<Slab *>(heap::allocate_aligned(size, alignof(Slot)));
+				if (!slab)
+					throw std::bad_alloc();
+				slab->next = nullptr;
+				slab->size = size;
+				slab->slots = (size - SLOTS_OFFSET) / sizeof(Slot);
+				if (next_size < MAX_SLAB_SIZE)
+					next_size *= 2;
+
+				(current ? current->next : first) = slab;
+			}
+
+			if (current)
+				current->carved = current->slots;
+			current = slab;
+			enter(slab);
+			return cursor++;
+		}
+
+		/* a slot is live if it was carved and is not on the free list; sorting both the free
+		   list and the slabs by address lets one merge-like walk tell them apart without memory */
+		void destroy_live() noexcept
+		{
+			current->carved = static_cast<size_t>(cursor - slots_of(current));
+			for (Slab *slab = current->next; slab; slab = slab->next)
+				slab->carved = 0;
+
+			free = sort_by_address(free, [](Slot *slot) -> Slot *& { return slot->next; });
+			first = sort_by_address(first, [](Slab *slab) -> Slab *& { return slab->next; });
+
+			Slot *next_free = free;
+			for (Slab *slab = first; slab; slab = slab->next)
+			{
+				Slot *slot = slots_of(slab);
+				for (Slot *const end = slot + slab->carved; slot != end; ++slot)
+				{
+					if (slot == next_free)
+						next_free = next_free->next;
+					else
+						std::launder(reinterpret_cast<T *>(slot))->~T();
+				}
+			}
+		}
+
+		/* bottom-up merge sort of a singly linked list */
+		template<typename Node, typename Link>
+		static Node *sort_by_address(Node *head, Link link) noexcept
+		{
+			for (size_t width = 1;; width *= 2)
+			{
+				Node *result = nullptr;
+				Node **tail = &result;
+				size_t merges = 0;
+
+				while (head)
+				{
+					++merges;
+					Node *left = head;
+					size_t left_size = 0;
+					while (head && left_size < width)
+					{
+						head = link(head);
+						++left_size;
+					}
+					Node *right = head;
+					size_t right_size = 0;
+					while (head && right_size < width)
+					{
+						head = link(head);
+						++right_size;
+					}
+
+					while (left_size || right_size)
+					{
+						Node *node;
+						if (!right_size || (left_size && reinterpret_cast<uintptr_t>(left) < reinterpret_cast<uintptr_t>(right)))
+						{
+							node = left;
+							left = link(left);
+							--left_size;
+						}
+						else
+						{
+							node = right;
+							right = link(right);
+							--right_size;
+						}
+						*tail = node;
+						tail = &link(node);
+					}
+				}
+
+				*tail = nullptr;
+				head = result;
+				if (merges <= 1)
+					return head;
+			}
+		}
+	};
+}
@@ -0,0 +1,173 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <acheron/__libdef.hpp>
+
+namespace ach
+{
+	/**
+	 * @brief Pointer storing the distance from itself to its target
+	 *
+	 * @note An offset_ptr and what it points to can be mapped at any address, as long as
+	 *  they move together, e.g. inside one shared memory segment mapped by several processes.
+	 *  Copying one recomputes the distance, so copies point to the same object from their
+	 *  own address; never copy one with memcpy.
+	 *
+	 * @note Converts implicitly to and from T *, so container code written against raw
+	 *  pointers works unchanged when only the pointers it stores are offset_ptr. Use it as the
+	 *  pointer type of an allocator, see ach::shared_allocator.
+	 * @tparam T Type pointed to; may be incomplete or void
+	 */
+	template<typename T>
+	class offset_ptr
+	{
+	public:
+		using element_type = T;
+		using value_type = std::remove_cv_t<T>;
+		using difference_type = ptrdiff_t;
+		using reference = std::add_lvalue_reference_t<T>;
+
+		template<typename U>
+		using rebind = offset_ptr<U>;
+
+		offset_ptr() noexcept = default;
+
+		offset_ptr(std::nullptr_t) noexcept {}
+
+		offset_ptr(T *p) noexcept
+		{
+			set(p);
+		}
+
+		offset_ptr(const offset_ptr &other) noexcept
+		{
+			set(other.get());
+		}
+
+		template<typename U> requires std::is_convertible_v<U *, T *>
+		offset_ptr(const offset_ptr<U> &other) noexcept
+		{
+			set(other.get());
+		}
+
+		/**
+		 * @brief Cast from a pointer to another type, e.g. from offset_ptr<void>
+		 */
+		template<typename U> requires (!std::is_convertible_v<U *, T *>)
+		explicit offset_ptr(const offset_ptr<U> &other) noexcept
+		{
+			set(static_cast<T *>(other.get()));
+		}
+
+		offset_ptr &operator=(const offset_ptr &other) noexcept
+		{
+			set(other.get());
+			return *this;
+		}
+
+		offset_ptr &operator=(T *p) noexcept
+		{
+			set(p);
+			return *this;
+		}
+
+		offset_ptr &operator=(std::nullptr_t) noexcept
+		{
+			offset = NULL_OFFSET;
+			return *this;
+		}
+
+		/**
+		 * @brief The raw pointer, valid in the calling process's mapping
+		 */
+		[[nodiscard]] T *get() const noexcept
+		{
+			if (offset == NULL_OFFSET)
+				return nullptr;
+			return reinterpret_cast<T *>(reinterpret_cast<uintptr_t>(this) + offset);
+		}
+
+		operator T *() const noexcept
+		{
+			return get();
+		}
+
+		T *operator->() const noexcept
+		{
+			return get();
+		}
+
+		template<typename U = T> requires (!std::is_void_v<U>)
+		U &operator*() const noexcept
+		{
+			return *get();
+		}
+
+		template<typename U = T> requires (!std::is_void_v<U>)
+		U &operator[](const difference_type i) const noexcept
+		{
+			return get()[i];
+		}
+
+		offset_ptr &operator+=(const difference_type n) noexcept
+		{
+			offset += n * static_cast<difference_type>(sizeof(T));
+			return *this;
+		}
+
+		offset_ptr &operator-=(const difference_type n) noexcept
+		{
+			offset -= n * static_cast<difference_type>(sizeof(T));
+			return *this;
+		}
+
+		offset_ptr &operator++() noexcept
+		{
+			return *this += 1;
+		}
+
+		offset_ptr operator++(int) noexcept
+		{
+			offset_ptr result(*this);
+			++*this;
+			return result;
+		}
+
+		offset_ptr &operator--() noexcept
+		{
+			return *this -= 1;
+		}
+
+		offset_ptr operator--(int) noexcept
+		{
+			offset_ptr result(*this);
+			--*this;
+			return result;
+		}
+
+		/**
+		 * @brief Pointer to `r`, for std::pointer_traits
+		 */
+		template<typename U = T> requires (!std::is_void_v<U>)
+		static offset_ptr pointer_to(U &r) noexcept
+		{
+			return offset_ptr(&r);
+		}
+
+	private:
+		/* a distance of one byte never occurs between aligned objects, so it stands for null */
+		static constexpr difference_type NULL_OFFSET = 1;
+
+		difference_type offset = NULL_OFFSET;
+
+		void set(T *p) noexcept
+		{
+			offset = p ? static_cast<difference_type>(reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(this))
+			           : NULL_OFFSET;
+		}
+	};
+}
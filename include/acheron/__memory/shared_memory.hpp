@@ -0,0 +1,677 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#pragma once
+
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <acheron/__atomic/spin_lock.hpp>
+#include <acheron/__libdef.hpp>
+#include <acheron/__memory/offset_ptr.hpp>
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ach
+{
+	namespace __detail
+	{
+		/* the first bytes of every shared segment; all positions are offsets from its start,
+		 * so every process works on it wherever the segment is mapped */
+		struct shared_heap
+		{
+			static constexpr uint64_t MAGIC = 0x6163686572736873; /* "achershs" */
+			static constexpr size_t HEADER = 16;                  /* in front of every block */
+			static constexpr size_t MIN_BLOCK = 32;
+			static constexpr size_t MAX_SMALL_BLOCK = 4096;
+			static constexpr size_t SMALL_CLASSES = 8;            /* 32 bytes to 4 KiB */
+			static constexpr size_t LARGE_GRANULE = 4096;
+			static constexpr size_t MAX_NAMES = 32;
+			static constexpr size_t MAX_NAME = 47;
+
+			struct Block
+			{
+				uint64_t size; /* including this header */
+				uint64_t next; /* next free block while this one is free */
+			};
+
+			struct Name
+			{
+				char name[MAX_NAME + 1];
+				uint64_t offset; /* of the object; zero if the entry is unused */
+			};
+
+			uint64_t magic;
+			uint64_t size;
+			spin_lock lock;
+			uint64_t top;                        /* start of the never used part */
+			uint64_t small_free[SMALL_CLASSES];  /* freed blocks of each power-of-two size */
+			uint64_t large_free;                 /* freed runs of pages, by address, coalesced */
+			Name names[MAX_NAMES];
+
+			explicit shared_heap(const size_t size) noexcept
+				: magic(MAGIC), size(size), top((sizeof(shared_heap) + LARGE_GRANULE - 1) & ~(LARGE_GRANULE - 1)),
+				  small_free {}, large_free(0), names {} {}
+
+			ACHERON_NOCOPY(shared_heap)
+			ACHERON_NOMOVE(shared_heap)
+
+			uint8_t *base() noexcept
+			{
+				return reinterpret_cast<uint8_t *>(this);
+			}
+
+			Block *block_at(const uint64_t offset) noexcept
+			{
+				return reinterpret_cast<Block *>(base() + offset);
+			}
+
+			uint64_t offset_of(const void *p) noexcept
+			{
+				return static_cast<uint64_t>(static_cast<const uint8_t *>(p) - base());
+			}
+
+			/* returns nullptr if the segment is full; blocks are aligned to 16 bytes */
+			void *allocate(const size_t bytes) noexcept
+			{
+				if (bytes > size)
+					return nullptr;
+
+				std::lock_guard guard(lock);
+				const size_t total = bytes + HEADER;
+				uint64_t offset = total <= MAX_SMALL_BLOCK ? allocate_small(total) : allocate_large(total);
+				return offset ? base() + offset + HEADER : nullptr;
+			}
+
+			void deallocate(void *p) noexcept
+			{
+				if (!p)
+					return;
+
+				std::lock_guard guard(lock);
+				const uint64_t offset = offset_of(p) - HEADER;
+				Block *block = block_at(offset);
+				if (block->size <= MAX_SMALL_BLOCK)
+				{
+					uint64_t &list = small_free[small_class(block->size)];
+					block->next = list;
+					list = offset;
+				}
+				else
+					free_large(offset);
+			}
+
+			/* bytes a block of `bytes` takes, header included */
+			static size_t block_size(const size_t bytes) noexcept
+			{
+				const size_t total = bytes + HEADER;
+				if (total <= MAX_SMALL_BLOCK)
+					return MIN_BLOCK << small_class(total);
+				return (total + LARGE_GRANULE - 1) & ~(LARGE_GRANULE - 1);
+			}
+
+			static size_t small_class(const size_t total) noexcept
+			{
+				return total <= MIN_BLOCK ? 0 : std::bit_width(total - 1) - std::bit_width(MIN_BLOCK - 1);
+			}
+
+			uint64_t carve(const size_t total) noexcept
+			{
+				if (total > size - top)
+					return 0;
+				const uint64_t offset = top;
+				top += total;
+				block_at(offset)->size = total;
+				return offset;
+			}
+
+			uint64_t allocate_small(const size_t total) noexcept
+			{
+				const size_t c = small_class(total);
+				if (const uint64_t offset = small_free[c])
+				{
+					small_free[c] = block_at(offset)->next;
+					return offset;
+				}
+				return carve(MIN_BLOCK << c);
+			}
+
+			/* first fit; the block is cut from the end of the run, so the run stays linked */
+			uint64_t allocate_large(size_t total) noexcept
+			{
+				total = (total + LARGE_GRANULE - 1) & ~(LARGE_GRANULE - 1);
+				for (uint64_t *link = &large_free; *link; link = &block_at(*link)->next)
+				{
+					Block *run = block_at(*link);
+					if (run->size < total)
+						continue;
+
+					if (run->size == total)
+					{
+						const uint64_t offset = *link;
+						*link = run->next;
+						return offset;
+					}
+
+					run->size -= total;
+					const uint64_t offset = *link + run->size;
+					block_at(offset)->size = total;
+					return offset;
+				}
+
+				return carve(total);
+			}
+
+			void free_large(const uint64_t offset) noexcept
+			{
+				/* `link` ends up holding the run the block joins, `prev_link` the one before it */
+				uint64_t *link = &large_free;
+				uint64_t *prev_link = nullptr;
+				while (*link && *link < offset)
+				{
+					prev_link = link;
+					link = &block_at(*link)->next;
+				}
+
+				Block *block = block_at(offset);
+				uint64_t next = *link;
+				if (next && offset + block->size == next)
+				{
+					block->size += block_at(next)->size;
+					next = block_at(next)->next;
+				}
+				if (prev_link && *prev_link + block_at(*prev_link)->size == offset)
+				{
+					block_at(*prev_link)->size += block->size;
+					link = prev_link;
+				}
+				else
+					*link = offset;
+				block_at(*link)->next = next;
+
+				/* a last run reaching the never used part goes back to it */
+				if (!next && *link + block_at(*link)->size == top)
+				{
+					top = *link;
+					*link = 0;
+				}
+			}
+
+			Name *find_name(const char *name) noexcept
+			{
+				for (Name &entry: names)
+				{
+					if (entry.offset && std::strcmp(entry.name, name) == 0)
+						return &entry;
+				}
+				return nullptr;
+			}
+		};
+	}
+
+	template<typename T>
+	class shared_allocator;
+
+	/**
+	 * @brief Memory shared between processes, with an allocator and named objects inside
+	 *
+	 * @note The segment is a POSIX shared memory object or an anonymous memfd of fixed size,
+	 *  mapped read-write. Memory is handed out by a small allocator whose state lives in the
+	 *  segment itself, guarded by a spin lock every process uses; a process dying while it
+	 *  allocates leaves that lock held.
+	 *
+	 * @note Containers built in the segment with ach::shared_allocator store offset_ptr, so a
+	 *  second process mapping the segment at another address reads them in place. Publish
+	 *  the top-level object under a name with construct() and look it up with find().
+	 *
+	 * @note Blocks are aligned to 16 bytes. Requests of up to 4 KiB come from power-of-two free
+	 *  lists; larger ones are rounded to 4 KiB and taken first-fit from coalesced free runs.
+	 */
+	class shared_segment
+	{
+	public:
+		static constexpr size_t MAX_ALIGNMENT = 16;
+
+		/**
+		 * @brief Create a new named segment, e.g. "/tables"; fails if the name exists
+		 *
+		 * @param name Name for shm_open; other processes open() it by the same name
+		 * @param size Size of the segment in bytes
+		 * @throw std::system_error if the object could not be created or mapped
+		 */
+		ACHERON_MAKE(shared_segment, const char *name, const size_t size)
+		{
+			const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (fd < 0)
+				throw_error("shm_open");
+
+			try
+			{
+				return shared_segment(fd, size, true);
+			}
+			catch (...)
+			{
+				shm_unlink(name);
+				throw;
+			}
+		}
+
+	#ifdef __linux__
+		/**
+		 * @brief Create a segment with no name, backed by a memfd
+		 *
+		 * @note Other processes get at it through fd(): inherited across fork, passed over a
+		 *  Unix socket, or opened as /proc/<pid>/fd/<fd>
+		 * @throw std::system_error if the memfd could not be created or mapped
+		 */
+		static shared_segment create_anonymous(const size_t size)
+		{
+			const int fd = memfd_create("ach::shared_segment", MFD_CLOEXEC);
+			if (fd < 0)
+				throw_error("memfd_create");
+			return shared_segment(fd, size, true);
+		}
+	#endif
+
+		/**
+		 * @brief Map an existing named segment
+		 *
+		 * @throw std::system_error if it does not exist or is not a segment
+		 */
+		static shared_segment open(const char *name)
+		{
+			const int fd = shm_open(name, O_RDWR, 0);
+			if (fd < 0)
+				throw_error("shm_open");
+			return shared_segment(fd, 0, false);
+		}
+
+		/**
+		 * @brief Map the segment behind a file descriptor, e.g. one obtained from fd()
+		 *
+		 * @note The descriptor is duplicated; the caller keeps its own
+		 * @throw std::system_error if it cannot be mapped or is not a segment
+		 */
+		static shared_segment attach(const int fd)
+		{
+			const int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+			if (own < 0)
+				throw_error("fcntl");
+			return shared_segment(own, 0, false);
+		}
+
+		/**
+		 * @brief Remove a named segment; mappings that exist keep working
+		 *
+		 * @return bool False if there was no such segment
+		 */
+		static bool remove(const char *name) noexcept
+		{
+			return shm_unlink(name) == 0;
+		}
+
+		shared_segment(shared_segment &&other) noexcept
+			: heap(std::exchange(other.heap, nullptr)), descriptor(std::exchange(other.descriptor, -1)) {}
+
+		shared_segment &operator=(shared_segment &&other) noexcept
+		{
+			if (this != &other)
+			{
+				unmap();
+				heap = std::exchange(other.heap, nullptr);
+				descriptor = std::exchange(other.descriptor, -1);
+			}
+			return *this;
+		}
+
+		ACHERON_NOCOPY(shared_segment)
+
+		/**
+		 * @brief Unmap the segment; the memory stays for as long as any process maps it
+		 */
+		~shared_segment()
+		{
+			unmap();
+		}
+
+		/**
+		 * @brief Allocate `bytes` bytes inside the segment
+		 *
+		 * @param align Required alignment; at most 16
+		 * @throw std::bad_alloc if the segment is full or the alignment is not supported
+		 */
+		[[nodiscard]] void *allocate(const size_t bytes, const size_t align = alignof(std::max_align_t))
+		{
+			void *result = align <= MAX_ALIGNMENT ? heap->allocate(bytes) : nullptr;
+			if (!result)
+				throw std::bad_alloc();
+			return result;
+		}
+
+		/**
+		 * @brief Return memory obtained from allocate; nullptr is ignored
+		 */
+		void deallocate(void *p) noexcept
+		{
+			heap->deallocate(p);
+		}
+
+		/**
+		 * @brief Construct an object in the segment and publish it under `name`
+		 *
+		 * @param name Up to 47 characters
+		 * @param args Arguments forwarded to T's constructor
+		 * @return T* The new object
+		 * @throw std::invalid_argument if the name is in use, too long or all names are taken;
+		 *  std::bad_alloc if the segment is full
+		 */
+		template<typename T, typename... Args>
+		T *construct(const char *name, Args &&... args)
+		{
+			ACHERON_STATIC_ASSERT(alignof(T) <= MAX_ALIGNMENT, "shared_segment aligns objects to 16 bytes");
+
+			if (std::strlen(name) > __detail::shared_heap::MAX_NAME)
+				throw std::invalid_argument("shared_segment: name is too long");
+
+			void *memory = allocate(sizeof(T), alignof(T));
+			T *object;
+			try
+			{
+				object = ::new(memory) T(std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				deallocate(memory);
+				throw;
+			}
+
+			std::unique_lock guard(heap->lock);
+			__detail::shared_heap::Name *entry = nullptr;
+			if (!heap->find_name(name))
+			{
+				for (auto &candidate: heap->names)
+				{
+					if (!candidate.offset)
+					{
+						entry = &candidate;
+						break;
+					}
+				}
+			}
+			if (!entry)
+			{
+				guard.unlock();
+				object->~T();
+				deallocate(memory);
+				throw std::invalid_argument("shared_segment: name is in use or no name is left");
+			}
+
+			std::strcpy(entry->name, name);
+			entry->offset = heap->offset_of(object);
+			return object;
+		}
+
+		/**
+		 * @brief The object published under `name`, or nullptr
+		 *
+		 * @note T must be the type it was constructed with
+		 */
+		template<typename T>
+		[[nodiscard]] T *find(const char *name) const noexcept
+		{
+			std::lock_guard guard(heap->lock);
+			const auto *entry = heap->find_name(name);
+			return entry ? reinterpret_cast<T *>(heap->base() + entry->offset) : nullptr;
+		}
+
+		/**
+		 * @brief Destroy the object published under `name` and free its name
+		 *
+		 * @return bool False if there was no such object
+		 */
+		template<typename T>
+		bool destroy(const char *name) noexcept
+		{
+			T *object;
+			{
+				std::lock_guard guard(heap->lock);
+				auto *entry = heap->find_name(name);
+				if (!entry)
+					return false;
+				object = reinterpret_cast<T *>(heap->base() + entry->offset);
+				entry->offset = 0;
+			}
+
+			object->~T();
+			deallocate(object);
+			return true;
+		}
+
+		/**
+		 * @brief Allocator drawing from this segment
+		 */
+		template<typename T>
+		[[nodiscard]] shared_allocator<T> get_allocator() const noexcept
+		{
+			return shared_allocator<T>(*this);
+		}
+
+		/**
+		 * @brief Address the segment is mapped at in this process
+		 */
+		[[nodiscard]] void *base() const noexcept
+		{
+			return heap;
+		}
+
+		/**
+		 * @brief Size of the segment in bytes
+		 */
+		[[nodiscard]] size_t size() const noexcept
+		{
+			return heap->size;
+		}
+
+		/**
+		 * @brief Bytes never handed out so far
+		 *
+		 * @note Freed blocks are kept on free lists and not counted
+		 */
+		[[nodiscard]] size_t unused() const noexcept
+		{
+			std::lock_guard guard(heap->lock);
+			return heap->size - heap->top;
+		}
+
+		/**
+		 * @brief The file descriptor behind the mapping, for attach() in another process
+		 */
+		[[nodiscard]] int fd() const noexcept
+		{
+			return descriptor;
+		}
+
+	private:
+		template<typename T>
+		friend class shared_allocator;
+
+		__detail::shared_heap *heap = nullptr;
+		int descriptor = -1;
+
+		/* takes ownership of fd; sizes it and sets it up if `init`, checks it otherwise */
+		shared_segment(const int fd, size_t size, const bool init) : descriptor(fd)
+		{
+			if (init)
+			{
+				if (size < sizeof(__detail::shared_heap) + __detail::shared_heap::LARGE_GRANULE)
+					size = sizeof(__detail::shared_heap) + __detail::shared_heap::LARGE_GRANULE;
+				if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+					fail("ftruncate");
+			}
+			else
+			{
+				struct stat info {};
+				if (fstat(fd, &info) != 0)
+					fail("fstat");
+				size = static_cast<size_t>(info.st_size);
+				if (size < sizeof(__detail::shared_heap))
+					fail("shared_segment", EINVAL);
+			}
+
+			void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mapping == MAP_FAILED)
+				fail("mmap");
+
+			if (init)
+				heap = ::new(mapping) __detail::shared_heap(size);
+			else
+			{
+				heap = static_cast<__detail::shared_heap *>(mapping);
+				if (heap->magic != __detail::shared_heap::MAGIC || heap->size != size)
+				{
+					munmap(mapping, size);
+					heap = nullptr;
+					fail("shared_segment", EINVAL);
+				}
+			}
+		}
+
+		void unmap() noexcept
+		{
+			if (heap)
+				munmap(heap, heap->size);
+			if (descriptor >= 0)
+				close(descriptor);
+			heap = nullptr;
+			descriptor = -1;
+		}
+
+		[[noreturn]] void fail(const char *what, const int error = errno)
+		{
+			close(descriptor);
+			descriptor = -1;
+			throw std::system_error(error, std::generic_category(), what);
+		}
+
+		[[noreturn]] static void throw_error(const char *what)
+		{
+			throw std::system_error(errno, std::generic_category(), what);
+		}
+	};
+
+	/**
+	 * @brief Allocator drawing from a shared_segment, with offset_ptr as its pointer type
+	 *
+	 * @note Holds an offset_ptr to the segment, so it stays valid wherever the segment is
+	 *  mapped as long as it lives in the segment too, like the containers using it. ach::vector,
+	 *  ach::basic_string, ach::map, ach::set and ach::unordered_map store only pointers of the
+	 *  allocator's type and can be read in place by every process mapping the segment.
+	 *
+	 * @note The segment must outlive every container using it; objects of types aligned to
+	 *  more than 16 bytes are not supported.
+	 * @tparam T Type of objects to allocate
+	 */
+	template<typename T>
+	class shared_allocator
+	{
+	public:
+		using value_type = T;
+		using pointer = offset_ptr<T>;
+		using const_pointer = offset_ptr<const T>;
+		using void_pointer = offset_ptr<void>;
+		using const_void_pointer = offset_ptr<const void>;
+		using size_type = size_t;
+		using difference_type = ptrdiff_t;
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+		using is_always_equal = std::false_type;
+
+		template<typename U>
+		struct rebind
+		{
+			using other = shared_allocator<U>;
+		};
+
+		explicit shared_allocator(const shared_segment &segment) noexcept : heap(segment.heap) {}
+
+		shared_allocator(const shared_allocator &other) noexcept = default;
+		shared_allocator &operator=(const shared_allocator &other) noexcept = default;
+
+		template<typename U>
+		shared_allocator(const shared_allocator<U> &other) noexcept : heap(other.heap) {}
+
+		/**
+		 * @brief Allocate memory for n objects of type T in the segment
+		 *
+		 * @return pointer The memory, or null if n is zero
+		 * @throw std::bad_alloc if the segment is full
+		 */
+		[[nodiscard]] pointer allocate(size_type n)
+		{
+			ACHERON_STATIC_ASSERT(alignof(T) <= shared_segment::MAX_ALIGNMENT, "shared_allocator aligns objects to 16 bytes");
+
+			if (n == 0)
+				return nullptr;
+
+			if (n > max_size())
+				throw std::bad_array_new_length();
+
+			void *result = heap->allocate(n * sizeof(T));
+			if (!result)
+				throw std::bad_alloc();
+
+			return static_cast<T *>(result);
+		}
+
+		void deallocate(pointer p, size_type) noexcept
+		{
+			heap->deallocate(p.get());
+		}
+
+		[[nodiscard]] size_type max_size() const noexcept
+		{
+			return std::numeric_limits<size_type>::max() / sizeof(T);
+		}
+
+		/**
+		 * @brief Bytes of the segment a block of n objects takes, its header included
+		 */
+		[[nodiscard]] size_t allocation_size(size_type n) const noexcept
+		{
+			return n ? __detail::shared_heap::block_size(n * sizeof(T)) : 0;
+		}
+
+		template<typename U>
+		friend class shared_allocator;
+
+		template<typename T1, typename T2>
+		friend bool operator==(const shared_allocator<T1> &lhs, const shared_allocator<T2> &rhs) noexcept;
+
+	private:
+		offset_ptr<__detail::shared_heap> heap;
+	};
+
+	template<typename T1, typename T2>
+	bool operator==(const shared_allocator<T1> &lhs, const shared_allocator<T2> &rhs) noexcept
+	{
+		return lhs.heap.get() == rhs.heap.get();
+	}
+
+	template<typename T1, typename T2>
+	bool operator!=(const shared_allocator<T1> &lhs, const shared_allocator<T2> &rhs) noexcept
+	{
+		return !(lhs == rhs);
+	}
+}
+#endif
@@ -0,0 +1,48 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <acheron/__atomic/spin_lock.hpp>
+#include <gtest/gtest.h>
+
+class SpinLockTestFixture : public testing::Test
+{
+protected:
+    ach::spin_lock lock;
+    static constexpr auto NUM_THREADS = 8;
+    static constexpr auto ITERATIONS = 10000;
+};
+
+TEST_F(SpinLockTestFixture, TryLock)
+{
+    EXPECT_TRUE(lock.try_lock());
+    EXPECT_FALSE(lock.try_lock());
+    lock.unlock();
+    EXPECT_TRUE(lock.try_lock());
+    lock.unlock();
+}
+
+TEST_F(SpinLockTestFixture, MutualExclusion)
+{
+    /* deliberately non-atomic; the lock is the only thing protecting it */
+    long counter = 0;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.emplace_back([&]
+        {
+            for (int j = 0; j < ITERATIONS; ++j)
+            {
+                std::lock_guard guard(lock);
+                ++counter;
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(counter, NUM_THREADS * ITERATIONS);
+}
@@ -318,3 +318,15 @@ TEST_F(DequeTest, StressTest)
 		GTEST_SKIP() << "stress test failed with unknown exception";
 	}
 }
+
+TEST_F(DequeTest, MemoryUsage)
+{
+	const size_t empty = int_deque.memory_usage();
+	for (int i = 0; i < 1000; ++i)
+		int_deque.push_back(i);
+
+	EXPECT_GE(int_deque.memory_usage(), empty + 1000 * sizeof(int));
+	for (int i = 0; i < 1000; ++i)
+		int_deque.push_front(i);
+	EXPECT_GE(int_deque.memory_usage(), 2000 * sizeof(int));
+}
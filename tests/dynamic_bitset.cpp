@@ -293,3 +293,12 @@ TEST_F(DynamicBitsetTest, StressTest)
 		GTEST_SKIP() << "Stress test failed with unknown exception";
 	}
 }
+
+TEST_F(DynamicBitsetTest, MemoryUsage)
+{
+	EXPECT_EQ(bitset.memory_usage(), 0u);
+
+	ach::dynamic_bitset<> bits(1000);
+	EXPECT_GE(bits.memory_usage(), 1000u / 8);
+	EXPECT_GE(bits.memory_usage(), bits.num_blocks_val() * sizeof(unsigned long));
+}
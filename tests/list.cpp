@@ -329,3 +329,44 @@ TEST_F(ListTest, Swap)
 	EXPECT_EQ(list1.front(), 4);
 	EXPECT_EQ(list2.front(), 1);
 }
+
+TEST_F(ListTest, BulkInsertion)
+{
+	ach::list<int> filled(static_cast<size_t>(1000), 7);
+	EXPECT_EQ(filled.size(), 1000);
+	EXPECT_TRUE(std::all_of(filled.begin(), filled.end(), [](int v) { return v == 7; }));
+
+	const std::vector<int> values = { 1, 2, 3, 4, 5 };
+	int_list = { 0, 6 };
+	auto it = int_list.insert(std::next(int_list.begin()), values.begin(), values.end());
+	EXPECT_EQ(*it, 1);
+	it = int_list.insert(int_list.end(), static_cast<size_t>(3), 9);
+	EXPECT_EQ(*it, 9);
+	EXPECT_EQ(int_list, ach::list<int>({ 0, 1, 2, 3, 4, 5, 6, 9, 9, 9 }));
+	EXPECT_EQ(int_list.insert(int_list.begin(), values.end(), values.end()), int_list.begin());
+
+	ach::list<int> copy(int_list);
+	EXPECT_EQ(copy, int_list);
+	copy.resize(20, 1);
+	EXPECT_EQ(copy.size(), 20);
+	EXPECT_EQ(copy.back(), 1);
+
+	copy.clear();
+	EXPECT_TRUE(copy.empty());
+	copy.push_back(42);
+	EXPECT_EQ(copy.front(), 42);
+}
+
+TEST_F(ListTest, MemoryUsage)
+{
+	EXPECT_EQ(int_list.memory_usage(), 0u);
+
+	for (int i = 0; i < 10; ++i)
+		int_list.push_back(i);
+	const size_t node = int_list.memory_usage() / 10;
+	EXPECT_EQ(int_list.memory_usage(), 10 * node);
+	EXPECT_GE(node, sizeof(int) + 2 * sizeof(void *));
+
+	int_list.pop_back();
+	EXPECT_EQ(int_list.memory_usage(), 9 * node);
+}
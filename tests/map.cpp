@@ -2,8 +2,10 @@
 
 #include <ranges>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <acheron/map>
+#include <acheron/string>
 #include <gtest/gtest.h>
 
 class MapTest : public ::testing::Test
@@ -342,3 +344,109 @@ TEST_F(MapTest, StressTest)
 		GTEST_SKIP() << "stress test failed with unknown exception";
 	}
 }
+
+TEST_F(MapTest, LargeCopyAndRangeInsert)
+{
+	constexpr int N = 5000;
+	for (int i = 0; i < N; ++i)
+		int_string_map[(i * 7919) % N] = std::to_string(i);
+
+	ach::map<int, std::string> copy(int_string_map);
+	EXPECT_EQ(copy.size(), int_string_map.size());
+	EXPECT_TRUE(std::ranges::equal(copy, int_string_map));
+
+	/* the copy keeps working as a tree of its own */
+	for (int i = 0; i < N; i += 2)
+		copy.erase(i);
+	copy[N] = "new";
+	EXPECT_EQ(copy.size(), N / 2 + 1);
+	EXPECT_EQ(int_string_map.size(), N);
+	EXPECT_TRUE(std::ranges::is_sorted(copy | std::views::keys));
+
+	ach::map<int, std::string> assigned = { { -1, "gone" } };
+	assigned = copy;
+	EXPECT_TRUE(std::ranges::equal(assigned, copy));
+	EXPECT_FALSE(assigned.contains(-1));
+
+	/* duplicates in a range keep the first value; the spare nodes are given back */
+	std::vector<std::pair<int, std::string> > items;
+	for (int i = 0; i < 100; ++i)
+		items.emplace_back(i % 10, std::to_string(i));
+	ach::map<int, std::string> ranged(items.begin(), items.end());
+	EXPECT_EQ(ranged.size(), 10);
+	EXPECT_EQ(ranged[3], "3");
+}
+
+TEST_F(MapTest, MemoryUsage)
+{
+	EXPECT_EQ(int_string_map.memory_usage(), 0u);
+
+	for (int i = 0; i < 100; ++i)
+		int_string_map[i] = "value";
+	const size_t node = int_string_map.memory_usage() / 100;
+	EXPECT_EQ(int_string_map.memory_usage(), 100 * node);
+	EXPECT_GE(node, sizeof(std::pair<const int, std::string>) + 3 * sizeof(void *));
+
+	int_string_map.erase(0);
+	EXPECT_EQ(int_string_map.memory_usage(), 99 * node);
+}
+
+namespace
+{
+	/* a key that counts how often one is built from a view */
+	struct name
+	{
+		static inline int built = 0;
+		std::string text;
+
+		explicit name(const std::string_view s) : text(s) { ++built; }
+	};
+
+	struct name_less
+	{
+		using is_transparent = void;
+
+		bool operator()(const name &a, const name &b) const { return a.text < b.text; }
+		bool operator()(const name &a, const std::string_view b) const { return a.text < b; }
+		bool operator()(const std::string_view a, const name &b) const { return a < b.text; }
+	};
+}
+
+TEST_F(MapTest, TransparentLookup)
+{
+	ach::map<ach::string, int, std::less<>> map;
+	map["a key long enough to live on the heap"] = 1;
+	map["another key long enough for the heap"] = 2;
+	map["short"] = 3;
+
+	const std::string_view view = "another key long enough for the heap";
+	EXPECT_EQ(map.find(view)->second, 2);
+	EXPECT_EQ(map.find("short")->second, 3);
+	EXPECT_EQ(map.find(std::string_view("missing")), map.end());
+	EXPECT_TRUE(map.contains(view));
+	EXPECT_EQ(map.count(std::string_view("short")), 1u);
+	EXPECT_EQ(map.lower_bound(std::string_view("b"))->second, 3);
+	EXPECT_EQ(map.upper_bound(view)->second, 3);
+
+	auto [first, last] = map.equal_range(view);
+	EXPECT_EQ(std::distance(first, last), 1);
+	EXPECT_EQ(first->second, 2);
+
+	EXPECT_EQ(map.erase(view), 1u);
+	EXPECT_EQ(map.erase(view), 0u);
+	EXPECT_EQ(map.size(), 2u);
+}
+
+TEST_F(MapTest, TransparentTryEmplaceBuildsKeyOnInsert)
+{
+	ach::map<name, int, name_less> map;
+	name::built = 0;
+
+	EXPECT_TRUE(map.try_emplace(std::string_view("key"), 1).second);
+	EXPECT_EQ(name::built, 1);
+
+	EXPECT_FALSE(map.try_emplace(std::string_view("key"), 2).second);
+	EXPECT_EQ(map.find(std::string_view("key"))->second, 1);
+	EXPECT_TRUE(map.contains(std::string_view("key")));
+	EXPECT_EQ(name::built, 1);
+}
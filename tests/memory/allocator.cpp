@@ -2,8 +2,10 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <list>
 #include <random>
+#include <thread>
 #include <vector>
 #include <acheron/__memory/allocator.hpp>
 #include <gtest/gtest.h>
@@ -292,6 +294,117 @@ TEST_F(AllocatorTestFixture, LargeAllocationTest)
 	int_allocator.deallocate(huge_ptr, HUGE_SIZE);
 }
 
+TEST_F(AllocatorTestFixture, MediumAllocationTest)
+{
+	/* everything between a page and the large threshold comes from multi-slice spans */
+	std::vector<size_t> sizes = { 4096, 8192, 65536, 100000, 512 * 1024, 1024 * 1024 - 64 };
+	std::vector<std::pair<int *, size_t> > ptrs;
+
+	for (int round = 0; round < 3; ++round)
+	{
+		for (size_t bytes: sizes)
+		{
+			const size_t n = bytes / sizeof(int);
+			int *ptr = int_allocator.allocate(n);
+			ASSERT_NE(ptr, nullptr);
+
+			ptr[0] = static_cast<int>(n);
+			ptr[n - 1] = static_cast<int>(n);
+			ptrs.emplace_back(ptr, n);
+		}
+	}
+
+	for (auto [ptr, n]: ptrs)
+	{
+		EXPECT_EQ(ptr[0], static_cast<int>(n));
+		EXPECT_EQ(ptr[n - 1], static_cast<int>(n));
+		int_allocator.deallocate(ptr, n);
+	}
+}
+
+TEST_F(AllocatorTestFixture, TrimReleasesFreeMemory)
+{
+	constexpr size_t BLOCK = 4096 / sizeof(int);
+	std::vector<int *> ptrs;
+
+	/* 32 MiB worth of pages, spread over several segments */
+	for (int i = 0; i < 8192; ++i)
+	{
+		int *ptr = int_allocator.allocate(BLOCK);
+		ASSERT_NE(ptr, nullptr);
+		ptr[0] = i;
+		ptrs.push_back(ptr);
+	}
+
+	for (int *ptr: ptrs)
+		int_allocator.deallocate(ptr, BLOCK);
+
+	ach::allocator_trim();
+	EXPECT_EQ(ach::allocator_trim(), 0u);
+
+	/* the heap keeps working after giving its memory away */
+	int *ptr = int_allocator.allocate(BLOCK);
+	ASSERT_NE(ptr, nullptr);
+	ptr[BLOCK - 1] = 42;
+	EXPECT_EQ(ptr[BLOCK - 1], 42);
+	int_allocator.deallocate(ptr, BLOCK);
+}
+
+TEST_F(AllocatorTestFixture, AllocationSize)
+{
+	EXPECT_EQ(ach::heap::allocation_size(1), 8u);
+	EXPECT_EQ(ach::heap::allocation_size(100), 112u);
+	EXPECT_EQ(ach::heap::allocation_size(129), 192u);
+	EXPECT_EQ(ach::heap::allocation_size(1000), 1024u);
+	EXPECT_EQ(ach::heap::allocation_size(1 << 20), (1u << 20) + 4096);
+	EXPECT_EQ(ach::heap::allocation_size(100, 64), 128u);
+
+	ach::allocator<int> alloc;
+	EXPECT_EQ(alloc.allocation_size(0), 0u);
+	EXPECT_EQ(alloc.allocation_size(25), 112u);
+	EXPECT_EQ(ach::allocation_size(alloc, 25), 112u);
+	EXPECT_EQ(ach::allocation_size(std::allocator<int>(), 25), 100u);
+
+	/* every size up to a block's class size lands in the same class */
+	for (size_t bytes = 1; bytes < 4096; bytes += 7)
+		EXPECT_EQ(ach::heap::allocation_size(ach::heap::allocation_size(bytes)), ach::heap::allocation_size(bytes));
+}
+
+TEST_F(AllocatorTestFixture, ReserveAndPin)
+{
+	const ach::allocator_config defaults = ach::allocator_configuration();
+	ach::allocator_config pinned = defaults;
+	pinned.pinned = true;
+	pinned.large_cache_decay_ms = 0;
+	ach::allocator_configure(pinned);
+	ach::allocator_trim();
+
+	/* 32 MiB of blocks, well past the point where free slices are normally purged */
+	EXPECT_EQ(ach::allocator_reserve(4096, 8192), 8192u);
+	const ach::allocator_statistics reserved = ach::allocator_stats();
+	EXPECT_GE(reserved.dirty_bytes, 24u * 1024 * 1024);
+	EXPECT_EQ(ach::allocator_trim(), 0u);
+
+	/* the reserved memory is reused rather than mapped anew */
+	std::vector<void *> blocks;
+	for (int i = 0; i < 8192; ++i)
+		blocks.push_back(ach::heap::allocate(4096));
+	EXPECT_EQ(ach::allocator_stats().segments, reserved.segments);
+	for (void *block: blocks)
+		ach::heap::deallocate(block, 4096);
+
+	/* cached large blocks do not decay while pinned */
+	EXPECT_EQ(ach::allocator_reserve(2 * 1024 * 1024, 4), 4u);
+	EXPECT_GE(ach::allocator_stats().large_cached_bytes, 8u * 1024 * 1024);
+	void *large = ach::heap::allocate(3 * 1024 * 1024);
+	ach::heap::deallocate(large, 3 * 1024 * 1024);
+	EXPECT_GE(ach::allocator_stats().large_cached_bytes, 8u * 1024 * 1024);
+
+	ach::allocator_configure(defaults);
+	EXPECT_GT(ach::allocator_trim(), 0u);
+	EXPECT_EQ(ach::allocator_stats().large_cached_bytes, 0u);
+}
+
 TEST_F(AllocatorTestFixture, BoundaryConditions)
 {
 	std::vector<size_t> boundary_sizes = { 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65 };
@@ -342,6 +455,375 @@ TEST_F(AllocatorTestFixture, AllocatorRebind)
 	double_alloc.deallocate(ptr, 10);
 }
 
+TEST_F(AllocatorTestFixture, CrossTypeReuse)
+{
+	/* every specialization shares one heap, so a block freed as ints comes back as doubles */
+	int *ints = int_allocator.allocate(4);
+	ASSERT_NE(ints, nullptr);
+	int_allocator.deallocate(ints, 4);
+
+	ach::allocator<double> double_allocator;
+	double *doubles = double_allocator.allocate(2);
+	EXPECT_EQ(static_cast<void *>(doubles), static_cast<void *>(ints));
+	double_allocator.deallocate(doubles, 2);
+}
+
+TEST_F(AllocatorTestFixture, SmallObjectsArePacked)
+{
+	/* blocks carry no header, so fresh 8-byte blocks sit right next to each other */
+	ach::allocator<ach::uint64_t> word_allocator;
+	std::vector<ach::uint64_t *> ptrs;
+	for (int i = 0; i < 1024; ++i)
+		ptrs.push_back(word_allocator.allocate(1));
+
+	std::sort(ptrs.begin(), ptrs.end());
+	size_t adjacent = 0;
+	for (size_t i = 1; i < ptrs.size(); ++i)
+		adjacent += ptrs[i] - ptrs[i - 1] == 1;
+	EXPECT_GT(adjacent, ptrs.size() / 2);
+
+	for (ach::uint64_t *ptr: ptrs)
+		word_allocator.deallocate(ptr, 1);
+}
+
+TEST_F(AllocatorTestFixture, AlignmentFollowsType)
+{
+	struct alignas(32) Wide { char bytes[32]; };
+	struct alignas(64) Line { char bytes[64]; };
+
+	ach::allocator<Wide> wide_allocator;
+	ach::allocator<Line> line_allocator;
+	for (size_t n = 1; n <= 64; ++n)
+	{
+		Wide *wide = wide_allocator.allocate(n);
+		Line *line = line_allocator.allocate(n);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(wide) % alignof(Wide), 0u) << n;
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(line) % alignof(Line), 0u) << n;
+		wide_allocator.deallocate(wide, n);
+		line_allocator.deallocate(line, n);
+	}
+}
+
+TEST_F(AllocatorTestFixture, OverAlignedAllocation)
+{
+	ach::allocator<char> byte_allocator;
+	for (size_t align = 1; align <= ach::heap::MAX_ALIGNMENT; align *= 2)
+	{
+		for (size_t n: { 1, 100, 5000, 70000, 2 * 1024 * 1024 })
+		{
+			char *p = byte_allocator.allocate(n, align);
+			ASSERT_NE(p, nullptr);
+			EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % align, 0u) << n << " " << align;
+			p[0] = 1;
+			p[n - 1] = 1;
+			byte_allocator.deallocate(p, n, align);
+		}
+	}
+
+	/* over-aligned blocks can also be released without their size */
+	void *page = ach::heap::allocate_aligned(100, 4096);
+	void *mapped = ach::heap::allocate_aligned(100, 1024 * 1024);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(page) % 4096, 0u);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(mapped) % (1024 * 1024), 0u);
+	ach::heap::deallocate(page);
+	ach::heap::deallocate(mapped);
+
+	EXPECT_EQ(ach::heap::allocate_aligned(64, 2 * ach::heap::MAX_ALIGNMENT), nullptr);
+	EXPECT_THROW((void) byte_allocator.allocate(64, 2 * ach::heap::MAX_ALIGNMENT), std::bad_alloc);
+}
+
+TEST_F(AllocatorTestFixture, NonPowerOfTwoAlignmentRejected)
+{
+	ach::allocator<char> byte_allocator;
+	for (const size_t align: { size_t(3), size_t(48), size_t(96), size_t(4096 + 16) })
+	{
+		EXPECT_EQ(ach::heap::allocate_aligned(64, align), nullptr) << align;
+		EXPECT_EQ(ach::heap::allocation_size(64, align), 0u) << align;
+		EXPECT_THROW((void) byte_allocator.allocate(64, align), std::bad_alloc) << align;
+	}
+}
+
+TEST_F(AllocatorTestFixture, OverAlignedTypes)
+{
+	struct alignas(128) Block { char bytes[128]; };
+	struct alignas(8192) Page { char bytes[100]; };
+
+	ach::allocator<Block> block_allocator;
+	ach::allocator<Page> page_allocator;
+	for (size_t n = 1; n <= 64; ++n)
+	{
+		Block *block = block_allocator.allocate(n);
+		Page *page = page_allocator.allocate(n);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % alignof(Block), 0u) << n;
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(page) % alignof(Page), 0u) << n;
+
+		page = page_allocator.reallocate(page, n, 2 * n);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(page) % alignof(Page), 0u) << n;
+		block_allocator.deallocate(block, n);
+		page_allocator.deallocate(page, 2 * n);
+	}
+
+	Block *blocks[10];
+	block_allocator.allocate_batch(10, blocks);
+	for (Block *block: blocks)
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % alignof(Block), 0u);
+	block_allocator.deallocate_batch(blocks, 10);
+}
+
+TEST_F(AllocatorTestFixture, SizedAndUnsizedDeallocation)
+{
+	for (size_t bytes: { 1, 24, 100, 5000, 300000, 2 * 1024 * 1024 })
+	{
+		void *sized = ach::heap::allocate(bytes);
+		void *unsized = ach::heap::allocate(bytes);
+		ASSERT_NE(sized, nullptr);
+		ASSERT_NE(unsized, nullptr);
+		static_cast<char *>(sized)[bytes - 1] = 1;
+		static_cast<char *>(unsized)[bytes - 1] = 1;
+
+		ach::heap::deallocate(sized, bytes);
+		ach::heap::deallocate(unsized);
+	}
+}
+
+TEST_F(AllocatorTestFixture, Reallocate)
+{
+	/* small blocks: same class stays put, anything else moves with its contents */
+	int *ptr = int_allocator.allocate(5);
+	for (int i = 0; i < 5; ++i)
+		ptr[i] = i;
+	EXPECT_TRUE(int_allocator.try_expand(ptr, 5, 6));
+	ptr = int_allocator.reallocate(ptr, 6, 1000);
+	for (int i = 0; i < 5; ++i)
+		EXPECT_EQ(ptr[i], i);
+
+	/* large blocks are remapped, never copied */
+	constexpr size_t MIB = 1024 * 1024 / sizeof(int);
+	ptr = int_allocator.reallocate(ptr, 1000, 2 * MIB);
+	for (int i = 0; i < 5; ++i)
+		EXPECT_EQ(ptr[i], i);
+	ptr[2 * MIB - 1] = 42;
+
+	ptr = int_allocator.reallocate(ptr, 2 * MIB, 64 * MIB);
+	EXPECT_EQ(ptr[4], 4);
+	EXPECT_EQ(ptr[2 * MIB - 1], 42);
+	ptr[64 * MIB - 1] = 7;
+
+	EXPECT_TRUE(int_allocator.try_expand(ptr, 64 * MIB, 3 * MIB));
+	EXPECT_EQ(ptr[2 * MIB - 1], 42);
+
+	ptr = int_allocator.reallocate(ptr, 3 * MIB, 16);
+	EXPECT_EQ(ptr[4], 4);
+	int_allocator.deallocate(ptr, 16);
+}
+
+TEST_F(AllocatorTestFixture, Statistics)
+{
+	constexpr size_t COUNT = 100;
+	constexpr size_t LARGE = 2 * 1024 * 1024 / sizeof(int);
+
+	const ach::allocator_statistics before = ach::allocator_stats();
+	const auto cls = std::find_if(std::begin(before.classes), std::end(before.classes),
+	                              [](const auto &c) { return c.block_size >= 40 * sizeof(int); }) - std::begin(before.classes);
+
+	std::vector<int *> ptrs;
+	for (size_t i = 0; i < COUNT; ++i)
+		ptrs.push_back(int_allocator.allocate(40));
+	int *large = int_allocator.allocate(LARGE);
+
+	const ach::allocator_statistics during = ach::allocator_stats();
+	EXPECT_GE(during.classes[cls].spans, 1u);
+	EXPECT_GE(during.segments, 1u);
+	EXPECT_EQ(during.segment_bytes, during.segments * 4 * 1024 * 1024);
+#if ACHERON_ALLOCATOR_STATS
+	EXPECT_EQ(during.classes[cls].allocations - before.classes[cls].allocations, COUNT);
+	EXPECT_EQ(during.classes[cls].live_blocks - before.classes[cls].live_blocks, COUNT);
+	EXPECT_EQ(during.large_allocations - before.large_allocations, 1u);
+	EXPECT_GE(during.large_bytes - before.large_bytes, LARGE * sizeof(int));
+#endif
+
+	for (int *ptr: ptrs)
+		int_allocator.deallocate(ptr, 40);
+	int_allocator.deallocate(large, LARGE);
+
+#if ACHERON_ALLOCATOR_STATS
+	const ach::allocator_statistics after = ach::allocator_stats();
+	EXPECT_EQ(after.classes[cls].frees - before.classes[cls].frees, COUNT);
+	EXPECT_EQ(after.classes[cls].live_blocks, before.classes[cls].live_blocks);
+	EXPECT_EQ(after.large_bytes, before.large_bytes);
+#endif
+}
+
+TEST_F(AllocatorTestFixture, HugePagePolicies)
+{
+	constexpr size_t MIB = 1024 * 1024 / sizeof(int);
+	const ach::allocator_config defaults = ach::allocator_configuration();
+	EXPECT_EQ(defaults.huge_pages, ach::huge_page_policy::none);
+	EXPECT_FALSE(defaults.populate);
+
+	/* hugetlb falls back to regular pages when no pool is reserved, so every policy works */
+	for (const auto policy: { ach::huge_page_policy::transparent, ach::huge_page_policy::hugetlb })
+	{
+		ach::allocator_config config;
+		config.huge_pages = policy;
+		config.populate = true;
+		ach::allocator_configure(config);
+		EXPECT_EQ(ach::allocator_configuration().huge_pages, policy);
+
+		int *ptr = int_allocator.allocate(3 * MIB);
+		ASSERT_NE(ptr, nullptr);
+		ptr[3 * MIB - 1] = 42;
+
+		ptr = int_allocator.reallocate(ptr, 3 * MIB, 9 * MIB);
+		ASSERT_NE(ptr, nullptr);
+		EXPECT_EQ(ptr[3 * MIB - 1], 42);
+		ptr[9 * MIB - 1] = 7;
+
+		EXPECT_TRUE(int_allocator.try_expand(ptr, 9 * MIB, 8 * MIB));
+		EXPECT_EQ(ptr[3 * MIB - 1], 42);
+		int_allocator.deallocate(ptr, 8 * MIB);
+
+		std::vector<int *> small;
+		for (int i = 0; i < 1000; ++i)
+			small.push_back(int_allocator.allocate(100));
+		for (int *p: small)
+			int_allocator.deallocate(p, 100);
+	}
+
+	ach::allocator_configure(defaults);
+}
+
+TEST_F(AllocatorTestFixture, LargeBlockCache)
+{
+	constexpr size_t MIB = 1024 * 1024 / sizeof(int);
+	const ach::allocator_config defaults = ach::allocator_configuration();
+	ach::allocator_config config = defaults;
+	config.large_cache_limit = 16 * 1024 * 1024;
+	config.large_cache_decay_ms = 60 * 1000;
+	ach::allocator_configure(config);
+	ach::allocator_trim();
+
+	/* a freed block is handed out again to the next request of about the same size */
+	int *ptr = int_allocator.allocate(4 * MIB);
+	ptr[4 * MIB - 1] = 42;
+	int_allocator.deallocate(ptr, 4 * MIB);
+	EXPECT_GE(ach::allocator_stats().large_cached_bytes, 4 * MIB * sizeof(int));
+
+	int *again = int_allocator.allocate(4 * MIB - 1000);
+	EXPECT_EQ(again, ptr);
+	EXPECT_EQ(ach::allocator_stats().large_cached_bytes, 0u);
+	again[4 * MIB - 1001] = 7;
+	EXPECT_TRUE(int_allocator.try_expand(again, 4 * MIB - 1000, 4 * MIB));
+	int_allocator.deallocate(again, 4 * MIB);
+
+	/* far smaller and bigger requests do not take it */
+	int *small = int_allocator.allocate(MIB);
+	int *big = int_allocator.allocate(8 * MIB);
+	EXPECT_NE(small, ptr);
+	EXPECT_NE(big, ptr);
+	int_allocator.deallocate(small, MIB);
+	int_allocator.deallocate(big, 8 * MIB);
+
+	/* the cache never grows past its limit */
+	std::vector<int *> blocks;
+	for (int i = 0; i < 8; ++i)
+		blocks.push_back(int_allocator.allocate(3 * MIB));
+	for (int *block: blocks)
+		int_allocator.deallocate(block, 3 * MIB);
+	EXPECT_LE(ach::allocator_stats().large_cached_bytes, config.large_cache_limit);
+
+	EXPECT_GT(ach::allocator_trim(), 0u);
+	EXPECT_EQ(ach::allocator_stats().large_cached_bytes, 0u);
+
+	/* without decay time or room, blocks are unmapped right away */
+	config.large_cache_decay_ms = 0;
+	ach::allocator_configure(config);
+	int_allocator.deallocate(int_allocator.allocate(2 * MIB), 2 * MIB);
+	EXPECT_EQ(ach::allocator_stats().large_cached_bytes, 0u);
+
+	config.large_cache_decay_ms = 60 * 1000;
+	config.large_cache_limit = 0;
+	ach::allocator_configure(config);
+	int_allocator.deallocate(int_allocator.allocate(2 * MIB), 2 * MIB);
+	EXPECT_EQ(ach::allocator_stats().large_cached_bytes, 0u);
+
+	ach::allocator_configure(defaults);
+}
+
+#if ACHERON_ALLOCATOR_SAMPLING
+/* two distinct call sites for the profiler to tell apart */
+[[gnu::noinline]] static void allocate_from_site_a(std::vector<int *> &out, size_t count)
+{
+	ach::allocator<int> alloc;
+	for (size_t i = 0; i < count; ++i)
+		out.push_back(alloc.allocate(16));
+}
+
+[[gnu::noinline]] static void allocate_from_site_b(std::vector<int *> &out, size_t count)
+{
+	ach::allocator<int> alloc;
+	for (size_t i = 0; i < count; ++i)
+		out.push_back(alloc.allocate(100));
+}
+
+TEST_F(AllocatorTestFixture, SamplingProfiler)
+{
+	constexpr size_t COUNT = 500;
+	constexpr size_t MIB = 1024 * 1024 / sizeof(int);
+	const ach::allocator_config defaults = ach::allocator_configuration();
+	EXPECT_EQ(defaults.sample_interval, 0u);
+
+	/* an interval of one byte samples every allocation */
+	ach::allocator_config config = defaults;
+	config.sample_interval = 1;
+	ach::allocator_configure(config);
+
+	/* the thread only notices once its current countdown runs out */
+	int_allocator.deallocate(int_allocator.allocate(2 * MIB), 2 * MIB);
+	ASSERT_EQ(ach::allocator_profile([](const ach::allocator_sample_site &) {}), 0u);
+
+	std::vector<int *> a, b;
+	allocate_from_site_a(a, COUNT);
+	allocate_from_site_b(b, COUNT);
+
+	/* frames only live as long as the visit */
+	std::vector<ach::allocator_sample_site> sites;
+	ach::allocator_profile([&](const ach::allocator_sample_site &site) { sites.push_back(site); });
+	ASSERT_EQ(sites.size(), 2u);
+	/* largest first */
+	EXPECT_EQ(sites[0].samples, COUNT);
+	EXPECT_EQ(sites[0].sampled_bytes, COUNT * 100 * sizeof(int));
+	EXPECT_GE(sites[0].bytes, sites[0].sampled_bytes);
+	EXPECT_EQ(sites[1].samples, COUNT);
+	EXPECT_EQ(sites[1].sampled_bytes, COUNT * 16 * sizeof(int));
+	EXPECT_GE(sites[0].depth, 1u);
+
+	/* samples go away however the blocks are freed: from another thread, in a batch or one by one */
+	std::thread([&]
+	{
+		ach::allocator<int> alloc;
+		for (int *ptr: a)
+			alloc.deallocate(ptr, 16);
+	}).join();
+	ach::heap::deallocate_batch(reinterpret_cast<void *const *>(b.data()), COUNT / 2, 100 * sizeof(int));
+	for (size_t i = COUNT / 2; i < COUNT; ++i)
+		int_allocator.deallocate(b[i], 100);
+	EXPECT_EQ(ach::allocator_profile([](const ach::allocator_sample_site &) {}), 0u);
+
+	/* a large block keeps its sample when its pages move */
+	int *large = int_allocator.allocate(2 * MIB);
+	large = int_allocator.reallocate(large, 2 * MIB, 64 * MIB);
+	sites.clear();
+	ach::allocator_profile([&](const ach::allocator_sample_site &site) { sites.push_back(site); });
+	ASSERT_EQ(sites.size(), 1u);
+	EXPECT_EQ(sites[0].sampled_bytes, 2 * MIB * sizeof(int));
+	int_allocator.deallocate(large, 64 * MIB);
+	EXPECT_EQ(ach::allocator_profile([](const ach::allocator_sample_site &) {}), 0u);
+
+	ach::allocator_configure(defaults);
+}
+#endif
+
 TEST_F(AllocatorTestFixture, MaxSizeTest)
 {
 	size_t max_size = int_allocator.max_size();
@@ -389,3 +871,201 @@ TEST_F(AllocatorTestFixture, FragmentationTest)
 		int_allocator.deallocate(allocations[i].ptr, allocations[i].size);
 }
 
+
+TEST_F(AllocatorTestFixture, MultiThreadedAllocation)
+{
+	std::vector<std::thread> threads;
+	std::atomic<int> failures = 0;
+
+	for (int t = 0; t < NUM_THREADS; ++t)
+	{
+		threads.emplace_back([t, &failures]
+		{
+			ach::allocator<int> alloc;
+			std::vector<std::pair<int *, size_t> > live;
+			std::mt19937 rng(t);
+			std::uniform_int_distribution<size_t> size_dist(1, 64);
+
+			for (int i = 0; i < ITERATIONS * 10; ++i)
+			{
+				const size_t size = size_dist(rng);
+				int *ptr = alloc.allocate(size);
+				for (size_t j = 0; j < size; ++j)
+					ptr[j] = t;
+				live.emplace_back(ptr, size);
+
+				/* free about half of what we allocate so the caches refill and drain */
+				if (rng() % 2 == 0)
+				{
+					auto [p, n] = live.back();
+					live.pop_back();
+					for (size_t j = 0; j < n; ++j)
+					{
+						if (p[j] != t)
+							++failures;
+					}
+					alloc.deallocate(p, n);
+				}
+			}
+
+			for (auto [p, n]: live)
+			{
+				for (size_t j = 0; j < n; ++j)
+				{
+					if (p[j] != t)
+						++failures;
+				}
+				alloc.deallocate(p, n);
+			}
+		});
+	}
+
+	for (auto &thread: threads)
+		thread.join();
+
+	EXPECT_EQ(failures.load(), 0);
+}
+
+TEST_F(AllocatorTestFixture, CrossThreadDeallocation)
+{
+	constexpr size_t COUNT = 4096;
+	std::vector<int *> pointers(COUNT);
+
+	std::thread producer([&]
+	{
+		ach::allocator<int> alloc;
+		for (size_t i = 0; i < COUNT; ++i)
+		{
+			pointers[i] = alloc.allocate(4);
+			pointers[i][0] = static_cast<int>(i);
+		}
+	});
+	producer.join();
+
+	std::thread consumer([&]
+	{
+		ach::allocator<int> alloc;
+		for (size_t i = 0; i < COUNT; ++i)
+		{
+			EXPECT_EQ(pointers[i][0], static_cast<int>(i));
+			alloc.deallocate(pointers[i], 4);
+		}
+	});
+	consumer.join();
+
+	/* the blocks must be reusable from yet another thread */
+	for (size_t i = 0; i < COUNT; ++i)
+	{
+		pointers[i] = int_allocator.allocate(4);
+		ASSERT_NE(pointers[i], nullptr);
+	}
+	for (size_t i = 0; i < COUNT; ++i)
+		int_allocator.deallocate(pointers[i], 4);
+}
+
+TEST_F(AllocatorTestFixture, ProducerConsumer)
+{
+	constexpr size_t ROUNDS = 200;
+	constexpr size_t COUNT = 1000;
+	struct message
+	{
+		size_t round;
+		size_t payload;
+		size_t index;
+	};
+	std::vector<message *> queue(COUNT);
+	std::atomic<size_t> produced = 0;
+	std::atomic<size_t> consumed = 0;
+	std::atomic<size_t> reused = 0;
+
+	const ach::allocator_statistics before = ach::allocator_stats();
+
+	/* the producer stays alive, so whatever the consumer frees has to find its way back to it */
+	std::thread producer([&]
+	{
+		ach::allocator<message> alloc;
+		std::vector<message *> previous;
+		for (size_t round = 0; round < ROUNDS; ++round)
+		{
+			while (consumed.load() != round)
+				std::this_thread::yield();
+
+			std::ranges::sort(previous);
+			for (size_t i = 0; i < COUNT; ++i)
+			{
+				queue[i] = alloc.allocate(1);
+				queue[i]->round = round;
+				queue[i]->index = i;
+				if (std::ranges::binary_search(previous, queue[i]))
+					reused.fetch_add(1);
+			}
+			previous = queue;
+			produced.store(round + 1);
+		}
+	});
+
+	std::thread consumer([&]
+	{
+		ach::allocator<message> alloc;
+		for (size_t round = 0; round < ROUNDS; ++round)
+		{
+			while (produced.load() != round + 1)
+				std::this_thread::yield();
+
+			for (size_t i = 0; i < COUNT; ++i)
+			{
+				EXPECT_EQ(queue[i]->round, round);
+				EXPECT_EQ(queue[i]->index, i);
+			}
+			/* one half block by block, the other in a single batch */
+			for (size_t i = 0; i < COUNT / 2; ++i)
+				alloc.deallocate(queue[i], 1);
+			alloc.deallocate_batch(queue.data() + COUNT / 2, COUNT - COUNT / 2);
+			consumed.store(round + 1);
+		}
+	});
+
+	producer.join();
+	consumer.join();
+
+	/* past the first round the producer lives off the blocks handed back to it */
+	EXPECT_GT(reused.load(), (ROUNDS - 1) * COUNT / 2);
+
+	const ach::allocator_statistics after = ach::allocator_stats();
+	const auto cls = std::find_if(std::begin(after.classes), std::end(after.classes),
+	                              [](const auto &c) { return c.block_size >= sizeof(message); }) - std::begin(after.classes);
+#if ACHERON_ALLOCATOR_STATS
+	EXPECT_EQ(after.classes[cls].allocations - before.classes[cls].allocations, ROUNDS * COUNT);
+	EXPECT_EQ(after.classes[cls].frees - before.classes[cls].frees, ROUNDS * COUNT);
+	EXPECT_EQ(after.classes[cls].live_blocks, before.classes[cls].live_blocks);
+#endif
+	EXPECT_LE(after.classes[cls].spans, before.classes[cls].spans + 1);
+}
+
+TEST_F(AllocatorTestFixture, BatchAllocation)
+{
+	/* more than one thread cache batch, so the central heap has to grow mid-call */
+	constexpr size_t COUNT = 5000;
+	std::vector<int *> ptrs(COUNT);
+	int_allocator.allocate_batch(COUNT, ptrs.data());
+
+	for (size_t i = 0; i < COUNT; ++i)
+	{
+		ASSERT_NE(ptrs[i], nullptr);
+		*ptrs[i] = static_cast<int>(i);
+	}
+	for (size_t i = 0; i < COUNT; ++i)
+		EXPECT_EQ(*ptrs[i], static_cast<int>(i));
+
+	std::vector<int *> sorted = ptrs;
+	std::ranges::sort(sorted);
+	EXPECT_EQ(std::ranges::adjacent_find(sorted), sorted.end());
+
+	/* batch blocks are ordinary ones, and batches may hold nullptr */
+	int_allocator.deallocate(ptrs.back(), 1);
+	ptrs.back() = nullptr;
+	int_allocator.deallocate_batch(ptrs.data(), COUNT);
+
+	int *single = int_allocator.allocate(1);
+	int_allocator.deallocate_batch(&single, 1);
+}
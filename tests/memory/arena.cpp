@@ -0,0 +1,118 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#include <acheron/__memory/arena.hpp>
+#include <acheron/list>
+#include <acheron/string>
+#include <acheron/vector>
+#include <gtest/gtest.h>
+
+class ArenaTestFixture : public testing::Test
+{
+protected:
+	ach::arena arena { 4096 };
+};
+
+TEST_F(ArenaTestFixture, BumpAllocation)
+{
+	auto *a = static_cast<char *>(arena.allocate(10, 1));
+	auto *b = static_cast<char *>(arena.allocate(10, 1));
+	ASSERT_NE(a, nullptr);
+	ASSERT_NE(b, nullptr);
+	EXPECT_EQ(b, a + 10);
+}
+
+TEST_F(ArenaTestFixture, Alignment)
+{
+	for (size_t align = 1; align <= 256; align *= 2)
+	{
+		(void) arena.allocate(1, 1);
+		void *p = arena.allocate(8, align);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % align, 0u) << align;
+	}
+}
+
+TEST_F(ArenaTestFixture, GrowsAndHandlesOversizedRequests)
+{
+	for (int i = 0; i < 100; ++i)
+	{
+		auto *p = static_cast<int *>(arena.allocate(1000 * sizeof(int), alignof(int)));
+		ASSERT_NE(p, nullptr);
+		p[0] = i;
+		p[999] = i;
+	}
+
+	auto *big = static_cast<char *>(arena.allocate(4 * 1024 * 1024, 64));
+	ASSERT_NE(big, nullptr);
+	big[4 * 1024 * 1024 - 1] = 1;
+	EXPECT_GE(arena.capacity(), 100 * 1000 * sizeof(int) + 4 * 1024 * 1024);
+}
+
+TEST_F(ArenaTestFixture, ResetReusesChunks)
+{
+	void *first = arena.allocate(100);
+	for (int i = 0; i < 50; ++i)
+		(void) arena.allocate(1000);
+	const size_t capacity = arena.capacity();
+
+	arena.reset();
+	EXPECT_EQ(arena.allocate(100), first);
+	for (int i = 0; i < 50; ++i)
+		(void) arena.allocate(1000);
+	EXPECT_EQ(arena.capacity(), capacity);
+}
+
+TEST_F(ArenaTestFixture, Release)
+{
+	(void) arena.allocate(100000);
+	EXPECT_GT(arena.capacity(), 0u);
+
+	arena.release();
+	EXPECT_EQ(arena.capacity(), 0u);
+	EXPECT_NE(arena.allocate(16), nullptr);
+}
+
+TEST_F(ArenaTestFixture, ZeroByteRequests)
+{
+	EXPECT_NE(arena.allocate(0), nullptr);
+
+	arena.release();
+	EXPECT_NE(arena.allocate(0, 1), nullptr);
+	EXPECT_NE(arena.allocate(0), nullptr);
+}
+
+TEST_F(ArenaTestFixture, Containers)
+{
+	for (int round = 0; round < 3; ++round)
+	{
+		{
+			ach::arena_allocator<int> alloc(arena);
+			ach::vector<int, ach::arena_allocator<int> > numbers(alloc);
+			for (int i = 0; i < 1000; ++i)
+				numbers.push_back(i);
+			EXPECT_EQ(numbers[999], 999);
+
+			ach::list<int, ach::arena_allocator<int> > items(alloc);
+			for (int i = 0; i < 100; ++i)
+				items.push_back(i);
+			EXPECT_EQ(items.size(), 100u);
+
+			using arena_string = ach::basic_string<char, std::char_traits<char>, ach::arena_allocator<char> >;
+			arena_string text("a string that is too long for the small buffer", alloc);
+			text += text;
+			EXPECT_EQ(text.size(), 92u);
+		}
+		arena.reset();
+	}
+}
+
+TEST_F(ArenaTestFixture, AllocatorEquality)
+{
+	ach::arena other;
+	ach::arena_allocator<int> a(arena);
+	ach::arena_allocator<double> b(arena);
+	ach::arena_allocator<int> c(other);
+
+	EXPECT_TRUE(a == b);
+	EXPECT_TRUE(a != c);
+	EXPECT_EQ(&ach::arena_allocator<char>(b).resource(), &arena);
+}
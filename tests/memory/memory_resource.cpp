@@ -0,0 +1,306 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#include <acheron/__memory/memory_resource.hpp>
+#include <acheron/deque>
+#include <acheron/list>
+#include <acheron/map>
+#include <acheron/set>
+#include <acheron/string>
+#include <acheron/unordered_map>
+#include <acheron/vector>
+#include <gtest/gtest.h>
+
+namespace
+{
+	/* forwards to the heap and keeps count, to see what reaches upstream */
+	class counting_resource final : public ach::pmr::memory_resource
+	{
+	public:
+		size_t allocations = 0;
+		size_t deallocations = 0;
+		size_t outstanding = 0;
+
+	private:
+		void *do_allocate(const size_t bytes, const size_t align) override
+		{
+			void *p = ach::pmr::heap_resource()->allocate(bytes, align);
+			++allocations;
+			outstanding += bytes;
+			return p;
+		}
+
+		void do_deallocate(void *p, const size_t bytes, const size_t align) noexcept override
+		{
+			ach::pmr::heap_resource()->deallocate(p, bytes, align);
+			++deallocations;
+			outstanding -= bytes;
+		}
+
+		bool do_is_equal(const memory_resource &other) const noexcept override
+		{
+			return this == &other;
+		}
+	};
+
+	int sum(const ach::pmr::vector<int> &values)
+	{
+		int total = 0;
+		for (const int v : values)
+			total += v;
+		return total;
+	}
+}
+
+TEST(MemoryResourceTest, HeapResourceAlignment)
+{
+	ach::pmr::memory_resource *heap = ach::pmr::heap_resource();
+	for (size_t align = 1; align <= 4096; align *= 2)
+	{
+		for (const size_t bytes : { size_t(1), size_t(24), size_t(1000), size_t(70000) })
+		{
+			void *p = heap->allocate(bytes, align);
+			ASSERT_NE(p, nullptr);
+			EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % align, 0u) << bytes << " " << align;
+			static_cast<char *>(p)[bytes - 1] = 1;
+			heap->deallocate(p, bytes, align);
+		}
+	}
+
+	void *big = heap->allocate(2 * 1024 * 1024, 1024 * 1024);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(big) % (1024 * 1024), 0u);
+	heap->deallocate(big, 2 * 1024 * 1024, 1024 * 1024);
+	EXPECT_THROW((void) heap->allocate(64, 4 * 1024 * 1024), std::bad_alloc);
+	EXPECT_EQ(*heap, *ach::pmr::heap_resource());
+}
+
+TEST(MemoryResourceTest, DefaultResource)
+{
+	EXPECT_EQ(ach::pmr::get_default_resource(), ach::pmr::heap_resource());
+
+	counting_resource counting;
+	EXPECT_EQ(ach::pmr::set_default_resource(&counting), ach::pmr::heap_resource());
+	{
+		ach::pmr::vector<int> values;
+		values.push_back(1);
+		EXPECT_EQ(values.get_allocator().resource(), &counting);
+	}
+	EXPECT_GT(counting.allocations, 0u);
+	EXPECT_EQ(counting.outstanding, 0u);
+
+	EXPECT_EQ(ach::pmr::set_default_resource(nullptr), &counting);
+	EXPECT_EQ(ach::pmr::get_default_resource(), ach::pmr::heap_resource());
+}
+
+TEST(MemoryResourceTest, MonotonicUsesBufferFirst)
+{
+	counting_resource upstream;
+	alignas(16) char buffer[256];
+	ach::pmr::monotonic_buffer_resource resource(buffer, sizeof(buffer), &upstream);
+
+	void *a = resource.allocate(16, 8);
+	void *b = resource.allocate(16, 8);
+	EXPECT_EQ(a, buffer);
+	EXPECT_EQ(static_cast<char *>(b), buffer + 16);
+	resource.deallocate(a, 16, 8);
+	EXPECT_EQ(upstream.allocations, 0u);
+
+	for (int i = 0; i < 100; ++i)
+	{
+		void *p = resource.allocate(100, 32);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % 32, 0u);
+		static_cast<char *>(p)[99] = 1;
+	}
+	EXPECT_GT(upstream.allocations, 0u);
+	EXPECT_LT(upstream.allocations, 10u);
+
+	resource.release();
+	EXPECT_EQ(upstream.outstanding, 0u);
+	EXPECT_EQ(upstream.deallocations, upstream.allocations);
+	EXPECT_EQ(resource.allocate(16, 8), buffer);
+}
+
+TEST(MemoryResourceTest, MonotonicReleasesOnDestruction)
+{
+	counting_resource upstream;
+	{
+		ach::pmr::monotonic_buffer_resource resource(&upstream);
+		EXPECT_EQ(resource.upstream_resource(), &upstream);
+
+		void *big = resource.allocate(1 << 20, 64);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(big) % 64, 0u);
+		static_cast<char *>(big)[(1 << 20) - 1] = 1;
+	}
+	EXPECT_EQ(upstream.allocations, 1u);
+	EXPECT_EQ(upstream.outstanding, 0u);
+}
+
+TEST(MemoryResourceTest, PoolReusesBlocks)
+{
+	counting_resource upstream;
+	ach::pmr::unsynchronized_pool_resource pool(&upstream);
+
+	void *a = pool.allocate(24, 8);
+	void *b = pool.allocate(24, 8);
+	EXPECT_NE(a, b);
+	pool.deallocate(a, 24, 8);
+	EXPECT_EQ(pool.allocate(20, 8), a);
+
+	for (size_t bytes = 1; bytes <= 4096; bytes *= 2)
+	{
+		void *p = pool.allocate(bytes, bytes < 64 ? bytes : 64);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % (bytes < 64 ? bytes : 64), 0u) << bytes;
+		pool.deallocate(p, bytes, bytes < 64 ? bytes : 64);
+	}
+
+	const size_t chunks = upstream.allocations;
+	for (int i = 0; i < 1000; ++i)
+	{
+		void *p = pool.allocate(24, 8);
+		pool.deallocate(p, 24, 8);
+	}
+	EXPECT_EQ(upstream.allocations, chunks);
+
+	pool.release();
+	EXPECT_EQ(upstream.outstanding, 0u);
+}
+
+TEST(MemoryResourceTest, PoolForwardsOversizedRequests)
+{
+	counting_resource upstream;
+	ach::pmr::unsynchronized_pool_resource pool({ 64, 1024 }, &upstream);
+	EXPECT_EQ(pool.options().largest_required_pool_block, 1024u);
+	EXPECT_EQ(pool.options().max_blocks_per_chunk, 64u);
+
+	void *a = pool.allocate(5000, 8);
+	void *b = pool.allocate(100000, 256);
+	void *c = pool.allocate(2000, 16);
+	EXPECT_EQ(upstream.allocations, 3u);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % 256, 0u);
+	static_cast<char *>(b)[99999] = 1;
+
+	pool.deallocate(b, 100000, 256);
+	EXPECT_EQ(upstream.deallocations, 1u);
+
+	(void) a;
+	(void) c;
+	pool.release();
+	EXPECT_EQ(upstream.outstanding, 0u);
+}
+
+TEST(MemoryResourceTest, ZeroByteRequests)
+{
+	ach::arena arena { 4096 };
+	ach::pmr::arena_resource on_arena(arena);
+	ach::pmr::monotonic_buffer_resource monotonic;
+	ach::pmr::unsynchronized_pool_resource pool;
+
+	for (ach::pmr::memory_resource *resource :
+	     { static_cast<ach::pmr::memory_resource *>(&on_arena), static_cast<ach::pmr::memory_resource *>(&monotonic),
+	       static_cast<ach::pmr::memory_resource *>(&pool), ach::pmr::heap_resource() })
+	{
+		void *p = nullptr;
+		EXPECT_NO_THROW(p = resource->allocate(0));
+		EXPECT_NE(p, nullptr);
+		resource->deallocate(p, 0);
+	}
+}
+
+TEST(MemoryResourceTest, Equality)
+{
+	ach::pmr::monotonic_buffer_resource m1, m2;
+	ach::pmr::unsynchronized_pool_resource pool;
+	ach::arena arena { 4096 };
+	ach::pmr::arena_resource r1(arena), r2(arena);
+
+	EXPECT_EQ(m1, m1);
+	EXPECT_NE(m1, m2);
+	EXPECT_NE(m1, pool);
+	EXPECT_EQ(r1, r2);
+
+	ach::pmr::polymorphic_allocator<int> a(&m1);
+	ach::pmr::polymorphic_allocator<double> b(a);
+	EXPECT_EQ(b.resource(), &m1);
+	EXPECT_TRUE(a == b);
+	EXPECT_TRUE(a != ach::pmr::polymorphic_allocator<int>(&m2));
+	EXPECT_TRUE(ach::pmr::polymorphic_allocator<int>() == ach::pmr::polymorphic_allocator<int>(ach::pmr::heap_resource()));
+}
+
+TEST(MemoryResourceTest, OneTypeAcrossResources)
+{
+	ach::arena arena { 4096 };
+	ach::pmr::arena_resource on_arena(arena);
+	ach::pmr::unsynchronized_pool_resource pool;
+
+	ach::pmr::vector<int> on_heap;
+	ach::pmr::vector<int> in_arena(&on_arena);
+	ach::pmr::vector<int> in_pool(&pool);
+	for (int i = 1; i <= 100; ++i)
+	{
+		on_heap.push_back(i);
+		in_arena.push_back(i);
+		in_pool.push_back(i);
+	}
+
+	EXPECT_EQ(sum(on_heap), 5050);
+	EXPECT_EQ(sum(in_arena), 5050);
+	EXPECT_EQ(sum(in_pool), 5050);
+	EXPECT_GT(arena.capacity(), 0u);
+
+	in_pool = std::move(in_arena);
+	EXPECT_EQ(in_pool.get_allocator().resource(), &on_arena);
+	EXPECT_EQ(sum(in_pool), 5050);
+}
+
+TEST(MemoryResourceTest, Containers)
+{
+	counting_resource upstream;
+	{
+		ach::pmr::unsynchronized_pool_resource pool(&upstream);
+
+		ach::pmr::string text(&pool);
+		text = "a string long enough to leave the small buffer behind";
+		EXPECT_EQ(text.size(), 53u);
+
+		ach::pmr::list<int> list(&pool);
+		ach::pmr::deque<int> deque(&pool);
+		ach::pmr::map<int, int> map(&pool);
+		ach::pmr::set<int> set(&pool);
+		ach::pmr::unordered_map<int, int> unordered(&pool);
+		for (int i = 0; i < 1000; ++i)
+		{
+			list.push_back(i);
+			deque.push_front(i);
+			map[i] = i * 2;
+			set.insert(i);
+			unordered[i] = i * 3;
+		}
+
+		EXPECT_EQ(list.size(), 1000u);
+		EXPECT_EQ(deque.front(), 999);
+		EXPECT_EQ(map[500], 1000);
+		EXPECT_EQ(set.count(999), 1u);
+		EXPECT_EQ(unordered[7], 21);
+		EXPECT_EQ(map.get_allocator().resource(), &pool);
+		EXPECT_GT(upstream.allocations, 0u);
+	}
+	EXPECT_EQ(upstream.outstanding, 0u);
+}
+
+TEST(MemoryResourceTest, NestedContainersShareResource)
+{
+	ach::pmr::monotonic_buffer_resource resource;
+	ach::pmr::vector<ach::pmr::string> lines(&resource);
+	lines.emplace_back("a line long enough to be allocated from the resource", &resource);
+	lines.push_back(ach::pmr::string("second", &resource));
+
+	EXPECT_EQ(lines[0].get_allocator().resource(), &resource);
+	EXPECT_EQ(lines[1].get_allocator().resource(), &resource);
+	EXPECT_EQ(lines[1], "second");
+
+	ach::pmr::polymorphic_allocator<ach::pmr::string> alloc(&resource);
+	ach::pmr::string *line = alloc.allocate(1);
+	alloc.construct(line, "constructed through the allocator, which passes itself along");
+	EXPECT_EQ(line->get_allocator().resource(), &resource);
+	alloc.destroy(line);
+	alloc.deallocate(line, 1);
+}
@@ -0,0 +1,186 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#include <acheron/__memory/object_pool.hpp>
+#include <acheron/string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+namespace
+{
+	struct session
+	{
+		static inline int alive = 0;
+
+		int id;
+		ach::string name;
+
+		session(const int id, const char *name) : id(id), name(name)
+		{
+			++alive;
+		}
+
+		~session()
+		{
+			--alive;
+		}
+	};
+
+	struct throwing
+	{
+		explicit throwing(const bool fail)
+		{
+			if (fail)
+				throw std::runtime_error("construction failed");
+		}
+	};
+
+	struct order
+	{
+		uint64_t id;
+		double price;
+	};
+
+	struct alignas(64) aligned
+	{
+		char bytes[10];
+	};
+}
+
+TEST(ObjectPoolTest, ConstructAndDestroy)
+{
+	ach::object_pool<session> pool;
+	session *a = pool.construct(1, "first");
+	session *b = pool.construct(2, "a name long enough to need its own allocation");
+	EXPECT_EQ(a->id, 1);
+	EXPECT_EQ(b->name, "a name long enough to need its own allocation");
+	EXPECT_EQ(pool.size(), 2u);
+	EXPECT_EQ(session::alive, 2);
+
+	pool.destroy(a);
+	EXPECT_EQ(session::alive, 1);
+	EXPECT_EQ(pool.construct(3, "third"), a);
+
+	pool.destroy(nullptr);
+	pool.destroy(a);
+	pool.destroy(b);
+	EXPECT_EQ(pool.size(), 0u);
+	EXPECT_EQ(session::alive, 0);
+}
+
+TEST(ObjectPoolTest, PacksObjectsDensely)
+{
+	ach::object_pool<order> orders;
+	order *previous = orders.construct(0u, 1.0);
+	for (uint64_t i = 1; i < 100; ++i)
+	{
+		order *p = orders.construct(i, 1.0);
+		EXPECT_EQ(p, previous + 1);
+		previous = p;
+	}
+
+	ach::object_pool<char> chars;
+	char *a = chars.construct('a');
+	char *b = chars.construct('b');
+	EXPECT_EQ(b - a, static_cast<ptrdiff_t>(sizeof(void *)));
+
+	ach::object_pool<aligned> wide;
+	for (int i = 0; i < 1000; ++i)
+	{
+		aligned *p = wide.construct();
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % 64, 0u);
+	}
+}
+
+TEST(ObjectPoolTest, GrowsAcrossSlabs)
+{
+	ach::object_pool<session> pool;
+	std::vector<session *> sessions;
+	for (int i = 0; i < 10000; ++i)
+		sessions.push_back(pool.construct(i, "session"));
+
+	EXPECT_GE(pool.capacity(), 10000u);
+	for (int i = 0; i < 10000; ++i)
+		EXPECT_EQ(sessions[i]->id, i);
+
+	for (session *s : sessions)
+		pool.destroy(s);
+	EXPECT_EQ(session::alive, 0);
+}
+
+TEST(ObjectPoolTest, ClearDestroysLiveObjects)
+{
+	ach::object_pool<session> pool;
+	std::vector<session *> sessions;
+	for (int i = 0; i < 5000; ++i)
+		sessions.push_back(pool.construct(i, "a name long enough to need its own allocation"));
+	for (int i = 0; i < 5000; i += 3)
+		pool.destroy(sessions[i]);
+	EXPECT_EQ(session::alive, 5000 - 1667);
+
+	const size_t capacity = pool.capacity();
+	pool.clear();
+	EXPECT_EQ(session::alive, 0);
+	EXPECT_EQ(pool.size(), 0u);
+
+	/* the slabs are kept and refilled before the heap is asked for more */
+	for (int i = 0; i < 5000; ++i)
+		(void) pool.construct(i, "again");
+	EXPECT_EQ(pool.capacity(), capacity);
+	EXPECT_EQ(session::alive, 5000);
+
+	pool.release();
+	EXPECT_EQ(session::alive, 0);
+	EXPECT_EQ(pool.capacity(), 0u);
+}
+
+TEST(ObjectPoolTest, DestructorDestroysLiveObjects)
+{
+	{
+		ach::object_pool<session> pool;
+		for (int i = 0; i < 100; ++i)
+			(void) pool.construct(i, "a name long enough to need its own allocation");
+	}
+	EXPECT_EQ(session::alive, 0);
+}
+
+TEST(ObjectPoolTest, ThrowingConstructorReturnsSlot)
+{
+	ach::object_pool<throwing> pool;
+	throwing *a = pool.construct(false);
+	pool.destroy(a);
+
+	EXPECT_THROW((void) pool.construct(true), std::runtime_error);
+	EXPECT_EQ(pool.size(), 0u);
+	EXPECT_EQ(pool.construct(false), a);
+}
+
+TEST(ObjectPoolTest, ThreadSafe)
+{
+	ach::object_pool<session, true> pool;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&pool, t]
+		{
+			std::vector<session *> mine;
+			for (int round = 0; round < 20; ++round)
+			{
+				for (int i = 0; i < 200; ++i)
+					mine.push_back(pool.construct(t, "worker"));
+				for (session *s : mine)
+				{
+					EXPECT_EQ(s->id, t);
+					pool.destroy(s);
+				}
+				mine.clear();
+			}
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+
+	EXPECT_EQ(pool.size(), 0u);
+	EXPECT_EQ(session::alive, 0);
+}
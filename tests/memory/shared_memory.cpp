@@ -0,0 +1,185 @@
+/* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
+
+#include <acheron/__memory/shared_memory.hpp>
+#include <acheron/map>
+#include <acheron/set>
+#include <acheron/string>
+#include <acheron/unordered_map>
+#include <acheron/vector>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+namespace
+{
+	template<typename T>
+	using shm_vector = ach::vector<T, ach::shared_allocator<T>>;
+	using shm_string = ach::basic_string<char, std::char_traits<char>, ach::shared_allocator<char>>;
+	using shm_map = ach::map<int, int, std::less<int>, ach::shared_allocator<std::pair<const int, int>>>;
+	using shm_set = ach::set<int, std::less<int>, ach::shared_allocator<int>>;
+	using shm_index = ach::unordered_map<int, int, std::hash<int>, std::equal_to<int>, ach::shared_allocator<std::pair<const int, int>>>;
+
+	struct catalog
+	{
+		shm_vector<int> ids;
+		shm_string title;
+		shm_map stock;
+		shm_set tags;
+		shm_index positions;
+
+		explicit catalog(const ach::shared_allocator<char> &alloc)
+			: ids(alloc), title(alloc), stock(alloc), tags(alloc), positions(alloc) {}
+	};
+}
+
+TEST(SharedMemoryTest, OffsetPtr)
+{
+	int values[4] = {1, 2, 3, 4};
+	ach::offset_ptr<int> p = values;
+	ach::offset_ptr<int> q = p;
+	EXPECT_EQ(q.get(), values);
+	EXPECT_EQ(q[2], 3);
+	++q;
+	EXPECT_EQ(*q, 2);
+	EXPECT_EQ(q - p, 1);
+	EXPECT_TRUE(p < q);
+
+	ach::offset_ptr<int> null;
+	EXPECT_FALSE(null);
+	EXPECT_EQ(null, nullptr);
+	null = values + 3;
+	EXPECT_EQ(*null, 4);
+	null = nullptr;
+	EXPECT_EQ(null.get(), nullptr);
+
+	ach::offset_ptr<void> erased = p;
+	EXPECT_EQ(static_cast<ach::offset_ptr<int>>(erased).get(), values);
+	EXPECT_EQ(std::pointer_traits<ach::offset_ptr<int>>::pointer_to(values[1]).get(), values + 1);
+}
+
+TEST(SharedMemoryTest, AllocateAndReuse)
+{
+	auto segment = ach::shared_segment::create_anonymous(1 << 20);
+	EXPECT_EQ(segment.size(), 1u << 20);
+
+	void *a = segment.allocate(24);
+	void *b = segment.allocate(100000);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % 16, 0u);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % 16, 0u);
+	segment.deallocate(a);
+	EXPECT_EQ(segment.allocate(30), a);
+
+	/* large blocks coalesce and go back to the never used part */
+	const size_t unused = segment.unused();
+	void *c = segment.allocate(200000);
+	segment.deallocate(b);
+	segment.deallocate(c);
+	EXPECT_GE(segment.unused(), unused);
+	EXPECT_EQ(segment.allocate(300000), b);
+
+	EXPECT_THROW((void) segment.allocate(2 << 20), std::bad_alloc);
+	EXPECT_THROW((void) segment.allocate(16, 64), std::bad_alloc);
+
+	std::vector<void *> blocks;
+	EXPECT_THROW(while (true) blocks.push_back(segment.allocate(5000)), std::bad_alloc);
+	for (void *p: blocks)
+		segment.deallocate(p);
+}
+
+TEST(SharedMemoryTest, NamedObjects)
+{
+	auto segment = ach::shared_segment::create_anonymous(64 * 1024);
+	int *counter = segment.construct<int>("counter", 41);
+	EXPECT_EQ(segment.find<int>("counter"), counter);
+	EXPECT_EQ(segment.find<int>("missing"), nullptr);
+	EXPECT_THROW((void) segment.construct<int>("counter", 0), std::invalid_argument);
+	EXPECT_THROW((void) segment.construct<int>("a name that is far too long to fit into the directory"), std::invalid_argument);
+
+	auto other = ach::shared_segment::attach(segment.fd());
+	EXPECT_NE(other.base(), segment.base());
+	++*other.find<int>("counter");
+	EXPECT_EQ(*counter, 42);
+
+	EXPECT_TRUE(segment.destroy<int>("counter"));
+	EXPECT_FALSE(segment.destroy<int>("counter"));
+	EXPECT_EQ(other.find<int>("counter"), nullptr);
+}
+
+TEST(SharedMemoryTest, ContainersReadThroughAnotherMapping)
+{
+	auto segment = ach::shared_segment::create_anonymous(4 << 20);
+	auto *data = segment.construct<catalog>("catalog", segment.get_allocator<char>());
+	for (int i = 0; i < 1000; ++i)
+	{
+		data->ids.push_back(i);
+		data->stock[i] = i * 2;
+		data->tags.insert(i % 10);
+		data->positions[i * 7] = i;
+	}
+	data->title = "a title long enough to be stored out of line";
+	data->title += " and then some";
+
+	/* a second mapping of the same memory sits at another address, as in another process */
+	auto other = ach::shared_segment::attach(segment.fd());
+	ASSERT_NE(other.base(), segment.base());
+	const catalog *view = other.find<catalog>("catalog");
+	ASSERT_NE(view, nullptr);
+	ASSERT_NE(static_cast<const void *>(view), static_cast<const void *>(data));
+
+	ASSERT_EQ(view->ids.size(), 1000u);
+	for (int i = 0; i < 1000; ++i)
+		EXPECT_EQ(view->ids[i], i);
+	EXPECT_EQ(view->title, "a title long enough to be stored out of line and then some");
+	EXPECT_GE(reinterpret_cast<uintptr_t>(view->title.data()), reinterpret_cast<uintptr_t>(other.base()));
+	ASSERT_EQ(view->stock.size(), 1000u);
+	EXPECT_EQ(view->stock.at(500), 1000);
+	int expected = 0;
+	for (const auto &[key, value]: view->stock)
+	{
+		EXPECT_EQ(key, expected);
+		EXPECT_EQ(value, expected++ * 2);
+	}
+	EXPECT_EQ(view->tags.size(), 10u);
+	EXPECT_TRUE(view->tags.contains(7));
+	ASSERT_EQ(view->positions.size(), 1000u);
+	for (int i = 0; i < 1000; ++i)
+		EXPECT_EQ(view->positions.at(i * 7), i);
+
+	/* and is written through just as well */
+	catalog *writer = other.find<catalog>("catalog");
+	writer->ids.push_back(1000);
+	writer->stock.erase(0);
+	writer->title = "short";
+	EXPECT_EQ(data->ids.back(), 1000);
+	EXPECT_FALSE(data->stock.contains(0));
+	EXPECT_EQ(data->title, "short");
+	EXPECT_EQ(data->ids.memory_usage(), data->ids.get_allocator().allocation_size(data->ids.capacity()));
+	EXPECT_EQ(data->stock.memory_usage() % 32, 0u);
+
+	shm_vector<int> copy(data->ids);
+	shm_vector<int> moved(std::move(copy));
+	EXPECT_EQ(moved.size(), 1001u);
+	shm_string text(segment.get_allocator<char>());
+	text = data->title;
+	text.swap(data->title);
+	EXPECT_EQ(text, "short");
+
+	segment.destroy<catalog>("catalog");
+}
+
+TEST(SharedMemoryTest, NamedSegment)
+{
+	const char *name = "/acheron-shared-memory-test";
+	ach::shared_segment::remove(name);
+	{
+		auto segment = ach::shared_segment::create(name, 64 * 1024);
+		EXPECT_THROW((void) ach::shared_segment::create(name, 64 * 1024), std::system_error);
+		*segment.construct<long>("answer") = 42;
+
+		auto other = ach::shared_segment::open(name);
+		EXPECT_EQ(*other.find<long>("answer"), 42);
+	}
+	EXPECT_TRUE(ach::shared_segment::remove(name));
+	EXPECT_THROW((void) ach::shared_segment::open(name), std::system_error);
+}
@@ -1,8 +1,10 @@
 /* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
 
 #include <string>
+#include <string_view>
 #include <set>
 #include <acheron/set>
+#include <acheron/string>
 #include <gtest/gtest.h>
 
 class SetTest : public ::testing::Test
@@ -425,3 +427,65 @@ TEST_F(SetTest, DuplicateElements)
     auto result = int_set.insert(2);  /* dupe */
     EXPECT_FALSE(result.second);
 }
+
+TEST_F(SetTest, LargeCopyAndRangeInsert)
+{
+    constexpr int N = 5000;
+    for (int i = 0; i < N; ++i)
+        int_set.insert((i * 7919) % N);
+
+    ach::set<int> copy(int_set);
+    EXPECT_EQ(copy.size(), int_set.size());
+    EXPECT_TRUE(std::equal(copy.begin(), copy.end(), int_set.begin(), int_set.end()));
+
+    for (int i = 0; i < N; i += 2)
+        copy.erase(i);
+    copy.insert(N);
+    EXPECT_EQ(copy.size(), N / 2 + 1);
+    EXPECT_TRUE(std::is_sorted(copy.begin(), copy.end()));
+
+    ach::set<int> assigned = { -1 };
+    assigned = copy;
+    EXPECT_TRUE(std::equal(assigned.begin(), assigned.end(), copy.begin(), copy.end()));
+
+    std::vector<int> values;
+    for (int i = 0; i < 100; ++i)
+        values.push_back(i % 10);
+    ach::set<int> ranged(values.begin(), values.end());
+    EXPECT_EQ(ranged.size(), 10);
+}
+
+TEST_F(SetTest, MemoryUsage)
+{
+    EXPECT_EQ(int_set.memory_usage(), 0u);
+
+    for (int i = 0; i < 100; ++i)
+        int_set.insert(i);
+    const size_t node = int_set.memory_usage() / 100;
+    EXPECT_EQ(int_set.memory_usage(), 100 * node);
+    EXPECT_GE(node, sizeof(int) + 3 * sizeof(void *));
+}
+
+TEST_F(SetTest, TransparentLookup)
+{
+    ach::set<ach::string, std::less<>> set;
+    set.insert(ach::string("a key long enough to live on the heap"));
+    set.insert(ach::string("short"));
+
+    const std::string_view view = "a key long enough to live on the heap";
+    EXPECT_NE(set.find(view), set.end());
+    EXPECT_EQ(set.find(std::string_view("missing")), set.end());
+    EXPECT_TRUE(set.contains("short"));
+    EXPECT_EQ(set.count(view), 1u);
+    EXPECT_EQ(*set.lower_bound(std::string_view("b")), "short");
+    EXPECT_EQ(set.upper_bound(std::string_view("short")), set.end());
+    EXPECT_EQ(std::distance(set.equal_range(view).first, set.equal_range(view).second), 1);
+
+    /* the key is only built when it is not there yet */
+    EXPECT_FALSE(set.insert(std::string_view("short")).second);
+    EXPECT_TRUE(set.insert(std::string_view("new")).second);
+    EXPECT_TRUE(set.contains(std::string_view("new")));
+
+    EXPECT_EQ(set.erase(view), 1u);
+    EXPECT_EQ(set.size(), 2u);
+}
@@ -1,6 +1,7 @@
 /* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
 
 #include <string>
+#include <string_view>
 #include <acheron/string>
 #include <gtest/gtest.h>
 
@@ -37,6 +38,22 @@ TEST(AcheronStringTest, Modification)
     EXPECT_EQ(s1, ach::string("Helloxx"));
 }
 
+TEST(AcheronStringTest, ReserveKeepsContents)
+{
+    ach::string s(100, 'a');
+    s += "end";
+
+    s.reserve(4 * 1024 * 1024);
+    EXPECT_GE(s.capacity(), 4 * 1024 * 1024);
+    EXPECT_EQ(s.size(), 103);
+    EXPECT_EQ(s[100], 'e');
+    EXPECT_EQ(s[102], 'd');
+
+    s.resize(8 * 1024 * 1024, 'b');
+    EXPECT_EQ(s[99], 'a');
+    EXPECT_EQ(s[s.size() - 1], 'b');
+}
+
 TEST(AcheronStringTest, Access)
 {
     ach::string s1 = "Hello";
@@ -86,3 +103,33 @@ TEST(AcheronStringTest, Capacity)
     s1.shrink_to_fit();
     EXPECT_EQ(s1.size(), 10);
 }
+
+TEST(AcheronStringTest, MemoryUsage)
+{
+    ach::string s = "short";
+    EXPECT_EQ(s.memory_usage(), 0u);
+
+    s.assign(100, 'x');
+    EXPECT_GE(s.memory_usage(), s.capacity() + 1);
+    EXPECT_EQ(s.memory_usage(), ach::heap::allocation_size(s.capacity() + 1));
+}
+
+TEST(AcheronStringTest, ViewComparisonsAndHash)
+{
+    const ach::string s = "a string long enough to live on the heap";
+    const std::string_view view = "a string long enough to live on the heap";
+
+    EXPECT_TRUE(s == view);
+    EXPECT_TRUE(view == s);
+    EXPECT_FALSE(s == std::string_view("a"));
+    EXPECT_TRUE(s < std::string_view("b"));
+    EXPECT_TRUE(std::string_view("a") < s);
+    EXPECT_TRUE(s < "b");
+    EXPECT_FALSE("a string long enough to live on the heap" < s);
+
+    /* equal strings hash alike whatever they are held in */
+    const ach::string_hash hash;
+    EXPECT_EQ(hash(s), hash(view));
+    EXPECT_EQ(hash(s), hash("a string long enough to live on the heap"));
+    EXPECT_EQ(std::hash<ach::string>{}(s), hash(view));
+}
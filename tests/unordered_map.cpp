@@ -1,8 +1,13 @@
 /* this file is a part of Acheron library which is under MIT license; see LICENSE for more info */
 
+#include <acheron/string>
 #include <acheron/unordered_map>
 #include <gtest/gtest.h>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 class UnorderedMapTest : public ::testing::Test
@@ -349,3 +354,606 @@ TEST_F(UnorderedMapTest, StressTest)
 		EXPECT_EQ(int_map[i], std::to_string(i));
 	}
 }
+
+TEST_F(UnorderedMapTest, MemoryUsage)
+{
+	const size_t empty = int_map.memory_usage();
+	EXPECT_GT(empty, 0u);
+
+	for (int i = 0; i < 1000; ++i)
+		int_map[i] = "value";
+	EXPECT_GE(int_map.memory_usage(), int_map.bucket_count() + 1000 * sizeof(std::pair<const int, std::string>));
+}
+
+namespace
+{
+	/* every key lands in the same bucket, to push probe distances past what a byte holds */
+	struct constant_hash
+	{
+		size_t operator()(int) const noexcept { return 42; }
+	};
+
+	struct throwing_value
+	{
+		static inline int alive = 0;
+
+		throwing_value(const bool fail)
+		{
+			if (fail)
+				throw std::runtime_error("construction failed");
+			++alive;
+		}
+
+		throwing_value(throwing_value &&) noexcept { ++alive; }
+		throwing_value(const throwing_value &) { ++alive; }
+		~throwing_value() { --alive; }
+	};
+
+	/* copies and moves start failing once armed, after a set number of them went through */
+	struct rehash_throwing_value
+	{
+		static inline int alive = 0;
+		static inline int countdown = -1;
+
+		int value;
+
+		rehash_throwing_value(const int v) : value(v) { ++alive; }
+		rehash_throwing_value(rehash_throwing_value &&other) : value(other.value) { tick(); ++alive; }
+		rehash_throwing_value(const rehash_throwing_value &other) : value(other.value) { tick(); ++alive; }
+		~rehash_throwing_value() { --alive; }
+
+		static void tick()
+		{
+			if (countdown >= 0 && countdown-- == 0)
+				throw std::runtime_error("relocation failed");
+		}
+	};
+
+	/* copies start failing once armed; moves never do */
+	struct copy_throwing_value
+	{
+		static inline int alive = 0;
+		static inline int countdown = -1;
+
+		int value;
+
+		copy_throwing_value(const int v) : value(v) { ++alive; }
+		copy_throwing_value(copy_throwing_value &&other) noexcept : value(other.value) { ++alive; }
+		copy_throwing_value(const copy_throwing_value &other) : value(other.value)
+		{
+			if (countdown >= 0 && countdown-- == 0)
+				throw std::runtime_error("copy failed");
+			++alive;
+		}
+		~copy_throwing_value() { --alive; }
+	};
+
+	/* a hash that fails once armed, after a set number of calls */
+	struct throwing_hash
+	{
+		static inline int countdown = -1;
+
+		size_t operator()(const int key) const
+		{
+			if (countdown >= 0 && countdown-- == 0)
+				throw std::runtime_error("hash failed");
+			return std::hash<int>{}(key);
+		}
+	};
+
+	template<typename Key, typename T, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+	using grouped_map = ach::unordered_map<Key, T, Hash, KeyEqual, ach::allocator<std::pair<const Key, T>>,
+	                                       ach::group_probing>;
+
+	/* random inserts, erases and lookups checked against std::unordered_map */
+	template<typename Map>
+	void expect_matches_std(Map &map)
+	{
+		std::unordered_map<int, std::string> reference;
+		uint32_t state = 12345;
+		for (int round = 0; round < 200000; ++round)
+		{
+			state = state * 1664525 + 1013904223;
+			const int key = static_cast<int>(state >> 20);
+			switch (state % 5)
+			{
+			case 0:
+			case 1:
+				EXPECT_EQ(map.try_emplace(key, std::to_string(key)).second,
+				          reference.try_emplace(key, std::to_string(key)).second);
+				break;
+			case 2:
+				EXPECT_EQ(map.erase(key), reference.erase(key));
+				break;
+			case 3:
+				map[key] += "x";
+				reference[key] += "x";
+				break;
+			default:
+				EXPECT_EQ(map.contains(key), reference.contains(key));
+				break;
+			}
+		}
+
+		ASSERT_EQ(map.size(), reference.size());
+		for (const auto &[key, value] : reference)
+		{
+			auto it = map.find(key);
+			ASSERT_NE(it, map.end());
+			EXPECT_EQ(it->second, value);
+		}
+		EXPECT_EQ(static_cast<size_t>(std::distance(map.begin(), map.end())), reference.size());
+	}
+}
+
+TEST_F(UnorderedMapTest, MatchesStdUnorderedMap)
+{
+	expect_matches_std(int_map);
+}
+
+TEST_F(UnorderedMapTest, KeysSharingLowBits)
+{
+	ach::unordered_map<int, int> map;
+	for (int i = 0; i < 4096; ++i)
+		map[i << 16] = i;
+
+	EXPECT_EQ(map.size(), 4096u);
+	for (int i = 0; i < 4096; ++i)
+		EXPECT_EQ(map.at(i << 16), i);
+}
+
+TEST_F(UnorderedMapTest, LongProbeSequences)
+{
+	ach::unordered_map<int, int, constant_hash> map;
+	for (int i = 0; i < 600; ++i)
+		map[i] = i;
+
+	for (int i = 0; i < 600; ++i)
+		EXPECT_EQ(map.at(i), i);
+
+	/* erasing from the front shifts values whose distance no longer fits in a byte */
+	for (int i = 0; i < 600; i += 3)
+		EXPECT_EQ(map.erase(i), 1u);
+	for (int i = 0; i < 600; ++i)
+		EXPECT_EQ(map.contains(i), i % 3 != 0);
+
+	auto copy = map;
+	copy.rehash(4096);
+	for (int i = 0; i < 600; ++i)
+		EXPECT_EQ(copy.contains(i), i % 3 != 0);
+}
+
+TEST_F(UnorderedMapTest, EraseWhileIterating)
+{
+	for (int i = 0; i < 1000; ++i)
+		int_map[i] = std::to_string(i);
+
+	for (auto it = int_map.begin(); it != int_map.end();)
+	{
+		if (it->first % 2)
+			it = int_map.erase(it);
+		else
+			++it;
+	}
+
+	EXPECT_EQ(int_map.size(), 500u);
+	for (const auto &[key, value] : int_map)
+		EXPECT_EQ(key % 2, 0);
+}
+
+TEST_F(UnorderedMapTest, EraseRangeAcrossDisplacedRun)
+{
+	/* one run of colliding keys: erasing from its middle shifts the values behind last into
+	   the range, which must not be erased in their place */
+	ach::unordered_map<int, int, constant_hash> colliding;
+	for (int i = 0; i < 20; ++i)
+		colliding[i] = i;
+
+	std::vector<int> order;
+	for (const auto &[key, value] : colliding)
+		order.push_back(key);
+
+	auto next = colliding.erase(std::next(colliding.begin(), 2), std::next(colliding.begin(), 7));
+	ASSERT_NE(next, colliding.end());
+	EXPECT_EQ(next->first, order[7]);
+	EXPECT_EQ(colliding.size(), 15u);
+	for (size_t i = 0; i < order.size(); ++i)
+		EXPECT_EQ(colliding.contains(order[i]), i < 2 || i >= 7);
+
+	/* and with the default hash, over many table layouts */
+	for (int seed = 0; seed < 200; ++seed)
+	{
+		ach::unordered_map<int, int> map;
+		std::vector<int> keys;
+		uint32_t state = static_cast<uint32_t>(seed);
+		for (int i = 0; i < 11; ++i)
+		{
+			state = state * 1664525 + 1013904223;
+			map[static_cast<int>(state >> 8)] = i;
+		}
+		for (const auto &[key, value] : map)
+			keys.push_back(key);
+
+		map.erase(std::next(map.begin(), 2), std::next(map.begin(), 7));
+		ASSERT_EQ(map.size(), keys.size() - 5);
+		for (size_t i = 0; i < keys.size(); ++i)
+			EXPECT_EQ(map.contains(keys[i]), i < 2 || i >= 7);
+	}
+
+	grouped_map<int, int, constant_hash> grouped;
+	for (int i = 0; i < 20; ++i)
+		grouped[i] = i;
+	grouped.erase(std::next(grouped.begin(), 2), std::next(grouped.begin(), 7));
+	EXPECT_EQ(grouped.size(), 15u);
+}
+
+TEST_F(UnorderedMapTest, ThrowingConstructorLeavesMapIntact)
+{
+	{
+		ach::unordered_map<int, throwing_value> map;
+		for (int i = 0; i < 100; ++i)
+			map.try_emplace(i, false);
+
+		for (int i = 100; i < 200; ++i)
+			EXPECT_THROW(map.try_emplace(i, true), std::runtime_error);
+		EXPECT_THROW(map.emplace(std::piecewise_construct, std::forward_as_tuple(500), std::forward_as_tuple(true)),
+		             std::runtime_error);
+
+		EXPECT_EQ(map.size(), 100u);
+		EXPECT_EQ(throwing_value::alive, 100);
+		for (int i = 0; i < 100; ++i)
+			EXPECT_TRUE(map.contains(i));
+		EXPECT_FALSE(map.contains(150));
+	}
+	EXPECT_EQ(throwing_value::alive, 0);
+}
+
+TEST_F(UnorderedMapTest, ThrowingRehashLeavesMapIntact)
+{
+	/* only group tables hold values whose move may throw */
+	{
+		grouped_map<int, rehash_throwing_value> map;
+		for (int i = 0; i < 5; ++i)
+			map.try_emplace(i, i);
+		const size_t buckets = map.bucket_count();
+
+		rehash_throwing_value::countdown = 2;
+		EXPECT_THROW(map.rehash(buckets * 4), std::runtime_error);
+		rehash_throwing_value::countdown = -1;
+
+		EXPECT_EQ(map.size(), 5u);
+		EXPECT_EQ(map.bucket_count(), buckets);
+		EXPECT_EQ(rehash_throwing_value::alive, 5);
+		for (int i = 0; i < 5; ++i)
+			EXPECT_EQ(map.at(i).value, i);
+
+		map.rehash(buckets * 4);
+		EXPECT_GT(map.bucket_count(), buckets);
+		EXPECT_EQ(rehash_throwing_value::alive, 5);
+		for (int i = 0; i < 5; ++i)
+			EXPECT_EQ(map.at(i).value, i);
+	}
+	EXPECT_EQ(rehash_throwing_value::alive, 0);
+
+	/* values that move without throwing still need the hash, which may throw halfway */
+	grouped_map<int, std::string, throwing_hash> map;
+	for (int i = 0; i < 5; ++i)
+		map[i] = std::to_string(i);
+	const size_t buckets = map.bucket_count();
+
+	throwing_hash::countdown = 2;
+	EXPECT_THROW(map.rehash(buckets * 4), std::runtime_error);
+	throwing_hash::countdown = -1;
+
+	EXPECT_EQ(map.size(), 5u);
+	EXPECT_EQ(map.bucket_count(), buckets);
+	for (int i = 0; i < 5; ++i)
+		EXPECT_EQ(map.at(i), std::to_string(i));
+}
+
+TEST_F(UnorderedMapTest, ThrowingCopyDuringShiftLeavesMapIntact)
+{
+	{
+		/* scattered keys in a table that is well filled, so most inserts land inside a run
+		   and shift it before the copy that throws */
+		ach::unordered_map<int, copy_throwing_value> map;
+		map.reserve(150);
+		for (int i = 0; i < 150; ++i)
+			map.try_emplace(i * 7919, i);
+		const size_t buckets = map.bucket_count();
+
+		for (int i = 150; i < 250; ++i)
+		{
+			const std::pair<const int, copy_throwing_value> value(i * 7919, i);
+			copy_throwing_value::countdown = 0;
+			EXPECT_THROW(map.insert(value), std::runtime_error);
+			copy_throwing_value::countdown = -1;
+		}
+
+		EXPECT_EQ(map.size(), 150u);
+		EXPECT_EQ(map.bucket_count(), buckets);
+		EXPECT_EQ(copy_throwing_value::alive, 150);
+		EXPECT_EQ(static_cast<size_t>(std::distance(map.begin(), map.end())), 150u);
+		for (int i = 0; i < 150; ++i)
+			EXPECT_EQ(map.at(i * 7919).value, i);
+		EXPECT_FALSE(map.contains(200 * 7919));
+	}
+	EXPECT_EQ(copy_throwing_value::alive, 0);
+
+	/* erase shifts runs back without calling a hash that may throw; it is stored instead */
+	ach::unordered_map<int, int, throwing_hash> hashed;
+	ach::unordered_map<int, int> plain;
+	hashed.reserve(100);
+	plain.reserve(100);
+	ASSERT_EQ(hashed.bucket_count(), plain.bucket_count());
+	EXPECT_EQ(hashed.memory_usage(), plain.memory_usage() + plain.bucket_count() * sizeof(size_t));
+}
+
+TEST_F(UnorderedMapTest, ValuesLiveInline)
+{
+	ach::unordered_map<int, int> map;
+	map.reserve(1000);
+	const size_t usage = map.memory_usage();
+	for (int i = 0; i < 1000; ++i)
+		map[i] = i;
+
+	/* no allocation per value; everything sits in the slot and metadata arrays */
+	EXPECT_EQ(map.memory_usage(), usage);
+	EXPECT_LT(usage, map.bucket_count() * (sizeof(std::pair<const int, int>) + 1) * 2);
+
+	const auto *first = &*map.find(0);
+	const auto *last = &*map.find(999);
+	EXPECT_LT(static_cast<size_t>(std::abs(last - first)), map.bucket_count());
+}
+
+TEST_F(UnorderedMapTest, GroupProbingMatchesStdUnorderedMap)
+{
+	grouped_map<int, std::string> map;
+	expect_matches_std(map);
+
+	/* deleted slots stay in the copy, or probes would stop short of values behind them */
+	const auto copy = map;
+	EXPECT_EQ(copy, map);
+}
+
+TEST_F(UnorderedMapTest, GroupProbingCollidingHashes)
+{
+	/* one fingerprint and one home group for all keys: every probe compares keys group by group */
+	grouped_map<int, int, constant_hash> map;
+	for (int i = 0; i < 600; ++i)
+		map[i] = i;
+	for (int i = 0; i < 600; ++i)
+		EXPECT_EQ(map.at(i), i);
+
+	for (int i = 0; i < 600; i += 3)
+		EXPECT_EQ(map.erase(i), 1u);
+	for (int i = 0; i < 600; ++i)
+		EXPECT_EQ(map.contains(i), i % 3 != 0);
+
+	for (int i = 0; i < 600; i += 3)
+		EXPECT_TRUE(map.try_emplace(i, -i).second);
+	EXPECT_EQ(map.size(), 600u);
+	EXPECT_EQ(map.at(300), -300);
+}
+
+TEST_F(UnorderedMapTest, GroupProbingReusesDeletedSlots)
+{
+	grouped_map<int, int> map;
+	for (int i = 0; i < 1000; ++i)
+		map[i] = i;
+	const size_t buckets = map.bucket_count();
+
+	/* churn through many more keys than fit, never holding more than a thousand */
+	for (int i = 1000; i < 100000; ++i)
+	{
+		map[i] = i;
+		EXPECT_EQ(map.erase(i - 1000), 1u);
+	}
+	EXPECT_EQ(map.size(), 1000u);
+	EXPECT_EQ(map.bucket_count(), buckets);
+	for (int i = 99000; i < 100000; ++i)
+		EXPECT_EQ(map.at(i), i);
+}
+
+TEST_F(UnorderedMapTest, GroupProbingEraseWhileIterating)
+{
+	grouped_map<int, std::string> map;
+	for (int i = 0; i < 1000; ++i)
+		map[i] = std::to_string(i);
+
+	for (auto it = map.begin(); it != map.end();)
+	{
+		if (it->first % 2)
+			it = map.erase(it);
+		else
+			++it;
+	}
+
+	EXPECT_EQ(map.size(), 500u);
+	for (const auto &[key, value] : map)
+		EXPECT_EQ(key % 2, 0);
+
+	map.clear();
+	EXPECT_TRUE(map.empty());
+	EXPECT_EQ(map.begin(), map.end());
+	map[7] = "seven";
+	EXPECT_EQ(map.at(7), "seven");
+}
+
+TEST_F(UnorderedMapTest, GroupProbingThrowingConstructorLeavesMapIntact)
+{
+	{
+		grouped_map<int, throwing_value> map;
+		for (int i = 0; i < 100; ++i)
+			map.try_emplace(i, false);
+
+		for (int i = 100; i < 200; ++i)
+			EXPECT_THROW(map.try_emplace(i, true), std::runtime_error);
+
+		EXPECT_EQ(map.size(), 100u);
+		EXPECT_EQ(throwing_value::alive, 100);
+		EXPECT_FALSE(map.contains(150));
+	}
+	EXPECT_EQ(throwing_value::alive, 0);
+}
+
+namespace
+{
+	struct counted_key
+	{
+		int value;
+
+		static inline int hashes = 0;
+		static inline int compares = 0;
+
+		bool operator==(const counted_key &other) const
+		{
+			++compares;
+			return value == other.value;
+		}
+	};
+
+	struct counted_hash
+	{
+		size_t operator()(const counted_key &key) const
+		{
+			++counted_key::hashes;
+			return std::hash<int>{}(key.value);
+		}
+	};
+
+	template<typename Map>
+	void expect_stored_hashes_used()
+	{
+		static_assert(ach::store_hash<counted_key>::value);
+
+		Map map;
+		for (int i = 0; i < 1000; ++i)
+			map[counted_key{i}] = i;
+
+		/* growing reads the stored hashes instead of hashing again */
+		counted_key::hashes = 0;
+		map.rehash(map.bucket_count() * 4);
+		EXPECT_EQ(counted_key::hashes, 0);
+
+		/* keys are only compared once their full hashes match */
+		counted_key::compares = 0;
+		for (int i = 0; i < 1000; ++i)
+			EXPECT_EQ(map.at(counted_key{i}), i);
+		EXPECT_EQ(counted_key::compares, 1000);
+
+		counted_key::compares = 0;
+		for (int i = 1000; i < 2000; ++i)
+			EXPECT_FALSE(map.contains(counted_key{i}));
+		EXPECT_EQ(counted_key::compares, 0);
+
+		for (int i = 0; i < 1000; i += 2)
+			map.erase(counted_key{i});
+		const Map copy = map;
+		for (int i = 0; i < 1000; ++i)
+			EXPECT_EQ(copy.contains(counted_key{i}), i % 2 == 1);
+	}
+}
+
+TEST_F(UnorderedMapTest, StoredHashesSkipComparisonsAndRehashing)
+{
+	expect_stored_hashes_used<ach::unordered_map<counted_key, int, counted_hash>>();
+	expect_stored_hashes_used<grouped_map<counted_key, int, counted_hash>>();
+}
+
+TEST_F(UnorderedMapTest, StoredHashMemoryUsage)
+{
+	static_assert(ach::store_hash<std::string>::value);
+	static_assert(!ach::store_hash<int>::value);
+
+	string_map["key"] = 1;
+	EXPECT_GE(string_map.memory_usage(), string_map.bucket_count() * (sizeof(std::pair<const std::string, int>) + 1 + sizeof(size_t)));
+}
+
+namespace
+{
+	template<typename Map>
+	void expect_transparent_lookup()
+	{
+		Map map;
+		map.try_emplace(std::string_view("a key long enough to live on the heap"), 1);
+		map["short"] = 2;
+
+		const std::string_view view = "a key long enough to live on the heap";
+		EXPECT_EQ(map.find(view)->second, 1);
+		EXPECT_EQ(map.find("short")->second, 2);
+		EXPECT_EQ(map.find(std::string_view("missing")), map.end());
+		EXPECT_TRUE(map.contains(view));
+		EXPECT_EQ(map.count(std::string_view("short")), 1u);
+		EXPECT_EQ(std::distance(map.equal_range(view).first, map.equal_range(view).second), 1);
+
+		EXPECT_FALSE(map.try_emplace(view, 3).second);
+		EXPECT_EQ(map.at("a key long enough to live on the heap"), 1);
+
+		EXPECT_EQ(map.erase(view), 1u);
+		EXPECT_EQ(map.erase(view), 0u);
+		EXPECT_EQ(map.size(), 1u);
+	}
+}
+
+TEST_F(UnorderedMapTest, TransparentLookup)
+{
+	expect_transparent_lookup<ach::unordered_map<ach::string, int, ach::string_hash, std::equal_to<>>>();
+	expect_transparent_lookup<grouped_map<ach::string, int, ach::string_hash, std::equal_to<>>>();
+}
+
+TEST_F(UnorderedMapTest, LazyEmplace)
+{
+	ach::unordered_map<std::string, int> words;
+	for (const char *word : {"to", "be", "or", "not", "to", "be"})
+		++words.lazy_emplace(word, [&](auto &&build) { build(word, 0); })->second;
+
+	EXPECT_EQ(words.size(), 4u);
+	EXPECT_EQ(words.at("to"), 2);
+	EXPECT_EQ(words.at("not"), 1);
+
+	/* a factory that builds nothing, or throws, leaves no trace */
+	EXPECT_THROW(words.lazy_emplace("gone", [](auto &&) {}), std::logic_error);
+	EXPECT_THROW(words.lazy_emplace("gone", [](auto &&build)
+	{
+		build("gone", 1);
+		throw std::runtime_error("factory failed");
+	}), std::runtime_error);
+	EXPECT_FALSE(words.contains("gone"));
+	EXPECT_EQ(words.size(), 4u);
+
+	/* an existing key never reaches the factory */
+	EXPECT_EQ(words.lazy_emplace("or", [](auto &&) { FAIL(); })->second, 1);
+
+	ach::unordered_map<ach::string, int, ach::string_hash, std::equal_to<>> named;
+	const std::string_view view = "a key long enough to live on the heap";
+	named.lazy_emplace(view, [&](auto &&build) { build(ach::string(view), 7); });
+	EXPECT_EQ(named.at(ach::string(view)), 7);
+}
+
+TEST_F(UnorderedMapTest, InsertionsProbeOnce)
+{
+	ach::unordered_map<counted_key, int, counted_hash> map;
+	counted_key::hashes = 0;
+	counted_key::compares = 0;
+
+	/* one hash per call, growth included, and one comparison per key already there */
+	for (int round = 0; round < 3; ++round)
+	{
+		for (int i = 0; i < 1000; ++i)
+			++map[counted_key{i}];
+	}
+	EXPECT_EQ(counted_key::hashes, 3000);
+	EXPECT_EQ(counted_key::compares, 2000);
+	EXPECT_EQ(map.at(counted_key{500}), 3);
+
+	/* emplace of a key and value, or of a pair, reads the key without building the value */
+	counted_key::hashes = 0;
+	throwing_value::alive = 0;
+	ach::unordered_map<counted_key, throwing_value, counted_hash> values;
+	EXPECT_TRUE(values.emplace(counted_key{1}, false).second);
+	EXPECT_FALSE(values.emplace(counted_key{1}, true).second);
+	EXPECT_FALSE(values.emplace(std::pair<counted_key, bool>(counted_key{1}, true)).second);
+	EXPECT_EQ(counted_key::hashes, 3);
+	EXPECT_EQ(throwing_value::alive, 1);
+}
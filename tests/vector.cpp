@@ -224,6 +224,22 @@ TEST_F(VectorTest, Reserve)
 	EXPECT_EQ(int_vector.capacity(), old_capacity);
 }
 
+TEST_F(VectorTest, LargeGrowthKeepsContents)
+{
+	/* trivially relocatable elements grow through allocator::reallocate, past the mmap threshold */
+	for (int i = 0; i < 1 << 20; ++i)
+		int_vector.push_back(i);
+
+	int_vector.reserve(int_vector.capacity() * 3);
+	for (int i = 0; i < 1 << 20; ++i)
+		ASSERT_EQ(int_vector[i], i);
+
+	int_vector.resize(10);
+	int_vector.shrink_to_fit();
+	EXPECT_EQ(int_vector.capacity(), 10);
+	EXPECT_EQ(int_vector[9], 9);
+}
+
 TEST_F(VectorTest, ShrinkToFit)
 {
 	int_vector.reserve(100);
@@ -373,3 +389,33 @@ TEST_F(VectorTest, AssignOperations)
 	EXPECT_EQ(int_vector[0], 4);
 	EXPECT_EQ(int_vector[3], 7);
 }
+
+TEST_F(VectorTest, OverAlignedElements)
+{
+	struct alignas(4096) Page { char bytes[4096]; };
+
+	ach::vector<Page> pages;
+	for (int i = 0; i < 300; ++i)
+	{
+		pages.push_back(Page());
+		pages.back().bytes[0] = static_cast<char>(i);
+		ASSERT_EQ(reinterpret_cast<uintptr_t>(&pages[0]) % alignof(Page), 0u) << i;
+	}
+
+	for (int i = 0; i < 300; ++i)
+		EXPECT_EQ(pages[i].bytes[0], static_cast<char>(i));
+}
+
+TEST_F(VectorTest, MemoryUsage)
+{
+	EXPECT_EQ(int_vector.memory_usage(), 0u);
+
+	int_vector.reserve(25);
+	int_vector.push_back(1);
+	EXPECT_EQ(int_vector.memory_usage(), ach::heap::allocation_size(25 * sizeof(int)));
+	EXPECT_GE(int_vector.memory_usage(), int_vector.capacity() * sizeof(int));
+
+	int_vector.clear();
+	int_vector.shrink_to_fit();
+	EXPECT_EQ(int_vector.memory_usage(), 0u);
+}